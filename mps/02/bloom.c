@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+#define BLOOM_MAX_K 8
+
+/* the table's hash may be weak in its high bits (DJB on short keys), so
+   both the block and the counters come from finalized copies of it */
+static unsigned long mix(unsigned long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+void bloom_init(bloom_t *f, unsigned long ncounters, unsigned long bits) {
+  void *p;
+  f->nblocks = (ncounters + BLOOM_COUNTERS - 1) / BLOOM_COUNTERS;
+  if (f->nblocks == 0)
+    f->nblocks = 1;
+  f->k = bits * 69 / 100;       /* ln 2 */
+  if (f->k < 1)
+    f->k = 1;
+  if (f->k > BLOOM_MAX_K)
+    f->k = BLOOM_MAX_K;
+  if (posix_memalign(&p, BLOOM_BLOCK, f->nblocks * BLOOM_BLOCK) != 0)
+    abort();
+  f->counts = p;
+  memset(f->counts, 0, f->nblocks * BLOOM_BLOCK);
+}
+
+/* the block for h, and in *pos 7 bits per counter, k of them */
+static unsigned char *block(const bloom_t *f, unsigned long h,
+                            unsigned long *pos) {
+  unsigned long m = mix(h);
+  *pos = m * 0x9e3779b97f4a7c15UL;
+  return f->counts + ((m >> 32) * f->nblocks >> 32) * BLOOM_BLOCK;
+}
+
+void bloom_add(bloom_t *f, unsigned long h) {
+  unsigned long pos;
+  unsigned char *b = block(f, h, &pos), *c;
+  int i, shift;
+
+  for (i=0; i<f->k; i++, pos >>= 7) {
+    c = b + (pos & 127) / 2;
+    shift = (pos & 1) * 4;
+    if (((*c >> shift) & 0xf) != 0xf)
+      *c += 1 << shift;
+  }
+}
+
+void bloom_remove(bloom_t *f, unsigned long h) {
+  unsigned long pos;
+  unsigned char *b = block(f, h, &pos), *c;
+  int i, shift, n;
+
+  for (i=0; i<f->k; i++, pos >>= 7) {
+    c = b + (pos & 127) / 2;
+    shift = (pos & 1) * 4;
+    n = (*c >> shift) & 0xf;
+    if (n && n != 0xf)
+      *c -= 1 << shift;
+  }
+}
+
+int bloom_maybe(const bloom_t *f, unsigned long h) {
+  unsigned long pos;
+  const unsigned char *b = block(f, h, &pos);
+  int i;
+
+  for (i=0; i<f->k; i++, pos >>= 7) {
+    if (!((b[(pos & 127) / 2] >> ((pos & 1) * 4)) & 0xf))
+      return 0;
+  }
+  return 1;
+}
+
+unsigned long bloom_bytes(const bloom_t *f) {
+  return f->nblocks * BLOOM_BLOCK;
+}
+
+void bloom_destroy(bloom_t *f) {
+  free(f->counts);
+  memset(f, 0, sizeof(bloom_t));
+}
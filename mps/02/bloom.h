@@ -0,0 +1,25 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/* Counting blocked Bloom filter over 64-bit hashes. Each key maps to one
+   64-byte block of 4-bit counters and sets k of them, so a test touches
+   a single cache line. Counters let keys be removed again; one that
+   reaches 15 sticks there, and is never decremented. */
+#define BLOOM_BLOCK    64                       /* bytes */
+#define BLOOM_COUNTERS (BLOOM_BLOCK * 2)        /* per block */
+
+typedef struct bloom {
+  unsigned long nblocks;        /* 0 = no filter */
+  int k;
+  unsigned char *counts;        /* nblocks * BLOOM_BLOCK, cache aligned */
+} bloom_t;
+
+/* room for about ncounters counters, at k = bits per key * ln 2 */
+void bloom_init(bloom_t *f, unsigned long ncounters, unsigned long bits);
+void bloom_add(bloom_t *f, unsigned long h);
+void bloom_remove(bloom_t *f, unsigned long h);
+int  bloom_maybe(const bloom_t *f, unsigned long h);
+unsigned long bloom_bytes(const bloom_t *f);
+void bloom_destroy(bloom_t *f);
+
+#endif
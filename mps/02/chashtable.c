@@ -0,0 +1,346 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashfn.h"
+#include "chashtable.h"
+
+#define MAX_THREADS   256
+#define RETIRE_BATCH  64     /* try to free retired memory this often */
+
+/* Epoch-based reclamation. Each thread in a read-side critical section
+   publishes the global epoch it entered under. The global epoch only
+   advances once every such thread has caught up with it, so memory
+   retired during epoch e is unreachable by the time the epoch is e + 2. */
+
+#define ACTIVE 1UL           /* low bit of a published epoch */
+
+struct rcu_thread {
+  unsigned long epoch;       /* (epoch << 1) | ACTIVE while reading, else 0 */
+  int in_use;
+  char pad[64 - sizeof(unsigned long) - sizeof(int)];
+};
+
+struct limbo {
+  void *ptr;
+  unsigned long epoch;
+};
+
+static unsigned long global_epoch = 2;
+static struct rcu_thread threads[MAX_THREADS];
+
+static __thread struct rcu_thread *self;
+static __thread int nest;
+static __thread struct limbo *limbo;
+static __thread unsigned long nlimbo, limbo_cap;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit(void *arg) {
+  cht_synchronize();
+  __atomic_store_n(&((struct rcu_thread *)arg)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_exit_key(void) {
+  pthread_key_create(&exit_key, thread_exit);
+}
+
+static struct rcu_thread *rcu_self(void) {
+  int i, free_slot;
+  if (self)
+    return self;
+  for (;;) {
+    for (i=0; i<MAX_THREADS; i++) {
+      free_slot = 0;
+      if (!__atomic_load_n(&threads[i].in_use, __ATOMIC_RELAXED)
+          && __atomic_compare_exchange_n(&threads[i].in_use, &free_slot, 1, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        self = &threads[i];
+        pthread_once(&exit_once, make_exit_key);
+        pthread_setspecific(exit_key, self);
+        return self;
+      }
+    }
+    sched_yield();
+  }
+}
+
+void cht_read_lock(void) {
+  struct rcu_thread *t = rcu_self();
+  if (nest++ == 0) {
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&t->epoch, (e << 1) | ACTIVE, __ATOMIC_RELAXED);
+    /* the announcement must be visible before any table pointer is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+}
+
+void cht_read_unlock(void) {
+  if (--nest == 0)
+    __atomic_store_n(&self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* advances the global epoch if no reader is still behind it */
+static unsigned long try_advance(void) {
+  unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), te;
+  int i;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (i=0; i<MAX_THREADS; i++) {
+    if (!__atomic_load_n(&threads[i].in_use, __ATOMIC_ACQUIRE))
+      continue;
+    te = __atomic_load_n(&threads[i].epoch, __ATOMIC_ACQUIRE);
+    if ((te & ACTIVE) && (te >> 1) != e)
+      return e;
+  }
+  __atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+}
+
+/* frees whatever in this thread's limbo list is two epochs old */
+static void reclaim(unsigned long epoch) {
+  unsigned long i, kept = 0;
+  for (i=0; i<nlimbo; i++) {
+    if (limbo[i].epoch + 2 <= epoch)
+      free(limbo[i].ptr);
+    else
+      limbo[kept++] = limbo[i];
+  }
+  nlimbo = kept;
+}
+
+/* frees ptr once no reader can hold a reference to it */
+static void retire(void *ptr) {
+  if (!ptr)
+    return;
+  if (nlimbo == limbo_cap) {
+    limbo_cap = limbo_cap ? limbo_cap * 2 : RETIRE_BATCH;
+    limbo = realloc(limbo, sizeof(struct limbo) * limbo_cap);
+  }
+  /* ptr was unlinked before this point; order that before the epoch read */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  limbo[nlimbo].ptr = ptr;
+  limbo[nlimbo].epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  if (++nlimbo % RETIRE_BATCH == 0)
+    reclaim(try_advance());
+}
+
+void cht_synchronize(void) {
+  unsigned long target = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) + 2;
+  while (nlimbo) {
+    unsigned long e = try_advance();
+    reclaim(e);
+    if (e < target)
+      sched_yield();
+  }
+  free(limbo);
+  limbo = NULL;
+  limbo_cap = 0;
+}
+
+/* The table proper. Bucket arrays are immutable in size; a resize builds
+   a new array of copied nodes and publishes it with a single store, so
+   readers on the old array still see a consistent (if stale) table. */
+
+typedef struct cht_node cht_node_t;
+
+struct cht_node {
+  cht_node_t *next;
+  unsigned long hash;
+  char *key;                 /* shared by the copies a resize makes */
+  void *val;
+};
+
+struct cht_table {
+  unsigned long size;        /* a multiple of nstripes */
+  cht_node_t *buckets[];
+};
+
+struct chashtable {
+  struct cht_table *tab;
+  unsigned int nstripes;
+  pthread_mutex_t *locks;
+  unsigned long count;
+  unsigned long seed;        /* for hash_sip, so collisions can't be aimed */
+};
+
+static unsigned long round_size(chashtable_t *ht, unsigned long size) {
+  if (size == 0)
+    size = 1;
+  return (size + ht->nstripes - 1) / ht->nstripes * ht->nstripes;
+}
+
+static struct cht_table *alloc_table(chashtable_t *ht, unsigned long size) {
+  struct cht_table *t;
+  size = round_size(ht, size);
+  t = calloc(1, sizeof(struct cht_table) + sizeof(cht_node_t *) * size);
+  t->size = size;
+  return t;
+}
+
+chashtable_t *make_chashtable(unsigned long size, unsigned int nstripes) {
+  chashtable_t *ht = calloc(1, sizeof(chashtable_t));
+  unsigned int i;
+  ht->nstripes = nstripes ? nstripes : 1;
+  ht->locks = malloc(sizeof(pthread_mutex_t) * ht->nstripes);
+  for (i=0; i<ht->nstripes; i++)
+    pthread_mutex_init(&ht->locks[i], NULL);
+  ht->tab = alloc_table(ht, size);
+  ht->seed = hash_random_seed();
+  return ht;
+}
+
+static unsigned long key_hash(chashtable_t *ht, const char *key) {
+  return hash_sip(key, strlen(key), ht->seed);
+}
+
+/* Writers lock the stripe for the key's hash. Since every table size is
+   a multiple of nstripes, that one lock covers the key's bucket in
+   whichever table is current once it is held. */
+static struct cht_table *lock_stripe(chashtable_t *ht, unsigned long h) {
+  pthread_mutex_lock(&ht->locks[h % ht->nstripes]);
+  return ht->tab;
+}
+
+static void unlock_stripe(chashtable_t *ht, unsigned long h) {
+  pthread_mutex_unlock(&ht->locks[h % ht->nstripes]);
+}
+
+/* Holds every stripe lock, so writers wait, but readers carry on against
+   the old array until the new one is published. The old nodes are then
+   retired; their keys and values live on in the copies. If expect is
+   nonzero, the resize is skipped unless the current array has that many
+   buckets, i.e. no other thread has resized it already. */
+static void resize(chashtable_t *ht, unsigned long newsize,
+                   unsigned long expect) {
+  struct cht_table *old, *t;
+  cht_node_t *b, *c;
+  unsigned long i;
+  unsigned int s;
+
+  for (s=0; s<ht->nstripes; s++)
+    pthread_mutex_lock(&ht->locks[s]);
+  old = ht->tab;
+  if ((!expect || expect == old->size) && round_size(ht, newsize) != old->size) {
+    t = alloc_table(ht, newsize);
+    for (i=0; i<old->size; i++) {
+      for (b = old->buckets[i]; b; b = b->next) {
+        c = malloc(sizeof(cht_node_t));
+        *c = *b;
+        c->next = t->buckets[b->hash % t->size];
+        t->buckets[b->hash % t->size] = c;
+      }
+    }
+    __atomic_store_n(&ht->tab, t, __ATOMIC_RELEASE);
+  } else {
+    old = NULL; /* nothing to do, or lost a race with another resize */
+  }
+  for (s=0; s<ht->nstripes; s++)
+    pthread_mutex_unlock(&ht->locks[s]);
+
+  if (old) {
+    for (i=0; i<old->size; i++) {
+      for (b = old->buckets[i]; b; b = c) {
+        c = b->next;
+        retire(b);
+      }
+    }
+    retire(old);
+  }
+}
+
+void cht_put(chashtable_t *ht, char *key, void *val) {
+  unsigned long h = key_hash(ht, key), size;
+  struct cht_table *t = lock_stripe(ht, h);
+  cht_node_t **head = &t->buckets[h % t->size], *b;
+
+  for (b = *head; b; b = b->next) {
+    if (b->hash == h && strcmp(b->key, key) == 0) {
+      retire(__atomic_exchange_n(&b->val, val, __ATOMIC_ACQ_REL));
+      unlock_stripe(ht, h);
+      free(key);
+      return;
+    }
+  }
+  b = malloc(sizeof(cht_node_t));
+  b->next = *head;
+  b->hash = h;
+  b->key = key;
+  b->val = val;
+  __atomic_store_n(head, b, __ATOMIC_RELEASE);
+  size = t->size;
+  unlock_stripe(ht, h);
+
+  if (__atomic_add_fetch(&ht->count, 1, __ATOMIC_RELAXED) > size)
+    resize(ht, size * 2, size);
+}
+
+void *cht_get(chashtable_t *ht, const char *key) {
+  unsigned long h = key_hash(ht, key);
+  struct cht_table *t;
+  cht_node_t *b;
+  void *val = NULL;
+
+  cht_read_lock();
+  t = __atomic_load_n(&ht->tab, __ATOMIC_ACQUIRE);
+  b = __atomic_load_n(&t->buckets[h % t->size], __ATOMIC_ACQUIRE);
+  for (; b; b = __atomic_load_n(&b->next, __ATOMIC_ACQUIRE)) {
+    if (b->hash == h && strcmp(b->key, key) == 0) {
+      val = __atomic_load_n(&b->val, __ATOMIC_ACQUIRE);
+      break;
+    }
+  }
+  cht_read_unlock();
+  return val;
+}
+
+void cht_del(chashtable_t *ht, const char *key) {
+  unsigned long h = key_hash(ht, key);
+  struct cht_table *t = lock_stripe(ht, h);
+  cht_node_t **p, *c;
+
+  for (p = &t->buckets[h % t->size]; (c = *p); p = &c->next) {
+    if (c->hash == h && strcmp(c->key, key) == 0) {
+      __atomic_store_n(p, c->next, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&ht->count, 1, __ATOMIC_RELAXED);
+      retire(c->key);
+      retire(c->val);
+      retire(c);
+      break;
+    }
+  }
+  unlock_stripe(ht, h);
+}
+
+void cht_resize(chashtable_t *ht, unsigned long newsize) {
+  resize(ht, newsize, 0);
+}
+
+unsigned long cht_count(chashtable_t *ht) {
+  return __atomic_load_n(&ht->count, __ATOMIC_RELAXED);
+}
+
+/* no other thread may be using the table */
+void free_chashtable(chashtable_t *ht) {
+  struct cht_table *t = ht->tab;
+  cht_node_t *b, *c;
+  unsigned long i;
+  unsigned int s;
+
+  cht_synchronize();
+  for (i=0; i<t->size; i++) {
+    for (b = t->buckets[i]; b; b = c) {
+      c = b->next;
+      free(b->key);
+      free(b->val);
+      free(b);
+    }
+  }
+  free(t);
+  for (s=0; s<ht->nstripes; s++)
+    pthread_mutex_destroy(&ht->locks[s]);
+  free(ht->locks);
+  free(ht);
+}
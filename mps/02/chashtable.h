@@ -0,0 +1,35 @@
+#ifndef CHASHTABLE_T
+#define CHASHTABLE_T
+
+/* A hashtable that may be shared by many threads. Writers lock one of a
+   fixed set of stripes, each covering every nstripes'th bucket; readers
+   take no locks at all. Unlinked nodes, keys and replaced values are
+   freed only after every thread that might still see them has left its
+   read-side critical section (epoch-based reclamation, as in RCU).
+   Keys are hashed with hash_sip under a random seed for each table, so
+   that the stripe a key locks cannot be chosen from outside.
+
+   Keys and values passed to cht_put must be malloc'd, and belong to the
+   table afterwards, as with ht_put. A value returned by cht_get stays
+   valid until the calling thread's outermost cht_read_unlock; callers
+   that do not bracket cht_get that way may only test it for NULL. */
+
+typedef struct chashtable chashtable_t;
+
+chashtable_t *make_chashtable(unsigned long size, unsigned int nstripes);
+void  cht_put(chashtable_t *ht, char *key, void *val);
+void *cht_get(chashtable_t *ht, const char *key);
+void  cht_del(chashtable_t *ht, const char *key);
+void  cht_resize(chashtable_t *ht, unsigned long newsize);
+unsigned long cht_count(chashtable_t *ht);
+void  free_chashtable(chashtable_t *ht);
+
+/* read-side critical sections; these nest */
+void  cht_read_lock(void);
+void  cht_read_unlock(void);
+
+/* waits until everything retired so far by this thread can be freed, and
+   frees it; call before a thread exits or the table is freed */
+void  cht_synchronize(void);
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#include "hashfn.h"
+
+/* Unaligned little-endian loads; memcpy compiles to a single mov. */
+static inline uint64_t r8(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t r4(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/* the same times-33 function as hash(), over a counted key */
+unsigned long hash_djb(const char *key, unsigned long len, unsigned long seed) {
+  const unsigned char *p = (const unsigned char *)key;
+  unsigned long hash = 5381;
+
+  while (len--)
+    hash = ((hash << 5) + hash) + *p++;
+  return hash;
+}
+
+/* FNV-1a, 64-bit: still a byte at a time, but it mixes far better than
+   times-33 in the low bits used to pick a bucket */
+unsigned long hash_fnv1a(const char *key, unsigned long len, unsigned long seed) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+
+  while (len--) {
+    h ^= *p++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/* xxHash64 (Yann Collet): four independent 8-byte lanes per 32-byte
+   stripe, so long keys hash at several bytes per cycle */
+#define P64_1 0x9e3779b185ebca87ULL
+#define P64_2 0xc2b2ae3d27d4eb4fULL
+#define P64_3 0x165667b19e3779f9ULL
+#define P64_4 0x85ebca77c2b2ae63ULL
+#define P64_5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t xx_round(uint64_t acc, uint64_t in) {
+  acc += in * P64_2;
+  acc = rotl(acc, 31);
+  return acc * P64_1;
+}
+
+static inline uint64_t xx_merge(uint64_t acc, uint64_t v) {
+  acc ^= xx_round(0, v);
+  return acc * P64_1 + P64_4;
+}
+
+unsigned long hash_xx64(const char *key, unsigned long len, unsigned long seed) {
+  const unsigned char *p = (const unsigned char *)key;
+  const unsigned char *end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + P64_1 + P64_2, v2 = seed + P64_2;
+    uint64_t v3 = seed, v4 = seed - P64_1;
+    do {
+      v1 = xx_round(v1, r8(p));
+      v2 = xx_round(v2, r8(p + 8));
+      v3 = xx_round(v3, r8(p + 16));
+      v4 = xx_round(v4, r8(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = xx_merge(h, v1);
+    h = xx_merge(h, v2);
+    h = xx_merge(h, v3);
+    h = xx_merge(h, v4);
+  } else {
+    h = seed + P64_5;
+  }
+  h += len;
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ xx_round(0, r8(p)), 27) * P64_1 + P64_4;
+  if (p + 4 <= end) {
+    h = rotl(h ^ (r4(p) * P64_1), 23) * P64_2 + P64_3;
+    p += 4;
+  }
+  for (; p < end; p++)
+    h = rotl(h ^ (*p * P64_5), 11) * P64_1;
+  h ^= h >> 33;
+  h *= P64_2;
+  h ^= h >> 29;
+  h *= P64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* wyhash-style: each step folds 16 bytes through one 64x64->128 multiply.
+   Keys of 16 bytes or less are read with at most four overlapping loads. */
+static const uint64_t wyp[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+unsigned long hash_wy(const char *key, unsigned long len, unsigned long seed) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t a, b, i = len;
+  __uint128_t r;
+
+  seed ^= wymix(seed ^ wyp[0], wyp[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+      b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wymix(r8(p) ^ wyp[1], r8(p + 8) ^ seed);
+        see1 = wymix(r8(p + 16) ^ wyp[2], r8(p + 24) ^ see1);
+        see2 = wymix(r8(p + 32) ^ wyp[3], r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wymix(r8(p) ^ wyp[1], r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = r8(p + i - 16);
+    b = r8(p + i - 8);
+  }
+  r = (__uint128_t)(a ^ wyp[1]) * (b ^ seed);
+  return wymix((uint64_t)r ^ wyp[0] ^ len, (uint64_t)(r >> 64) ^ wyp[1]);
+}
+
+/* Two interleaved CRC32C lanes over 8-byte words using the SSE4.2 crc32
+   instruction, finished with a 64-bit avalanche. Falls back to hash_wy
+   on CPUs without SSE4.2. */
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned long crc32c_hw(const char *key, unsigned long len,
+                               unsigned long seed) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t a = (uint32_t)seed, b = (uint32_t)(seed >> 32) ^ 0x9e3779b9;
+  uint64_t tail = 0, h;
+
+  for (; len >= 16; len -= 16, p += 16) {
+    a = _mm_crc32_u64(a, r8(p));
+    b = _mm_crc32_u64(b, r8(p + 8));
+  }
+  if (len >= 8) {
+    a = _mm_crc32_u64(a, r8(p));
+    p += 8;
+    len -= 8;
+  }
+  memcpy(&tail, p, len);
+  b = _mm_crc32_u64(b, tail ^ ((uint64_t)len << 56));
+  h = (a << 32) | b;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+#endif
+
+unsigned long hash_crc32c(const char *key, unsigned long len, unsigned long seed) {
+#if defined(__x86_64__)
+  static int have_sse42 = -1;
+  if (have_sse42 < 0)
+    have_sse42 = __builtin_cpu_supports("sse4.2");
+  if (have_sse42)
+    return crc32c_hw(key, len, seed);
+#endif
+  return hash_wy(key, len, seed);
+}
+
+/* SipHash-2-4 (Aumasson and Bernstein), keyed by the seed: a PRF, so
+   without the seed an attacker cannot find keys that collide. The
+   128-bit key is the seed and a mix of it. */
+#define SIPROUND                                                \
+  do {                                                          \
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);   \
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;                      \
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;                      \
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);   \
+  } while (0)
+
+static uint64_t siphash24(uint64_t k0, uint64_t k1, const unsigned char *p,
+                          unsigned long len) {
+  const unsigned char *end = p + (len & ~7UL);
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL, v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL, v3 = k1 ^ 0x7465646279746573ULL;
+  uint64_t m, b = (uint64_t)len << 56;
+  int i;
+
+  for (; p != end; p += 8) {
+    m = r8(p);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  for (i=0; i<(int)(len & 7); i++)
+    b |= (uint64_t)p[i] << (8 * i);
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+unsigned long hash_sip(const char *key, unsigned long len, unsigned long seed) {
+  return siphash24(seed, rotl(seed * P64_1, 32) ^ P64_3,
+                   (const unsigned char *)key, len);
+}
+
+/* a seed for a new table, from the kernel's entropy pool if it will
+   give us one without blocking */
+unsigned long hash_random_seed(void) {
+  unsigned long seed;
+  struct timespec ts;
+
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed))
+    return seed;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000000000UL + ts.tv_nsec) * P64_1 ^ getpid();
+}
+
+const ht_hashfn_info_t ht_hashfns[] = {
+  { "djb",    hash_djb },
+  { "fnv1a",  hash_fnv1a },
+  { "xx64",   hash_xx64 },
+  { "wy",     hash_wy },
+  { "crc32c", hash_crc32c },
+  { "sip",    hash_sip },
+  { NULL,     NULL }
+};
+
+ht_hashfn_t ht_hashfn_by_name(const char *name) {
+  const ht_hashfn_info_t *h;
+  for (h = ht_hashfns; h->name; h++)
+    if (strcmp(h->name, name) == 0)
+      return h->fn;
+  return NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef HASHFN_H
+#define HASHFN_H
+
+/* String hash functions for make_hashtable_cfg. Each hashes len bytes of
+   key; seed selects one of a family of functions (hash_djb ignores it). */
+typedef unsigned long (*ht_hashfn_t)(const char *key, unsigned long len,
+                                     unsigned long seed);
+
+typedef struct ht_hashfn_info {
+  const char *name;
+  ht_hashfn_t fn;
+} ht_hashfn_info_t;
+
+unsigned long hash_djb(const char *key, unsigned long len, unsigned long seed);
+unsigned long hash_fnv1a(const char *key, unsigned long len, unsigned long seed);
+unsigned long hash_xx64(const char *key, unsigned long len, unsigned long seed);
+unsigned long hash_wy(const char *key, unsigned long len, unsigned long seed);
+unsigned long hash_crc32c(const char *key, unsigned long len, unsigned long seed);
+unsigned long hash_sip(const char *key, unsigned long len, unsigned long seed);
+
+/* a fresh seed for each call, as unpredictable as can be managed */
+unsigned long hash_random_seed(void);
+
+/* every function above, by name; terminated by a NULL name */
+extern const ht_hashfn_info_t ht_hashfns[];
+
+ht_hashfn_t ht_hashfn_by_name(const char *name);
+
+#endif
@@ -0,0 +1,366 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+
+/* Compact hashtable, after CPython's dict: entries are appended to one
+   dense array, so they stay in insertion order, and an open-addressed
+   index of 8, 16 or 32-bit entry numbers, twice as long as the entries
+   array is usable, maps hashes to them. Iteration reads the entries
+   array straight through; only lookups touch the index. A deleted entry
+   leaves a hole (a NULL key) until the next resize compacts the array. */
+
+/* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
+   See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
+unsigned long hash(char *str) {
+  unsigned long hash = 5381;
+  int c;
+
+  while ((c = *str++))
+    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+
+  return hash;
+}
+
+/* the probe sequence shifts the high bits in, so spread them first, as
+   the open-addressed table does */
+static unsigned long mix(unsigned long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+static unsigned long key_hash(hashtable_t *ht, const char *key) {
+  if (ht->hashfn)
+    return mix(ht->hashfn(key, strlen(key), ht->seed));
+  return mix(hash((char *)key));
+}
+
+static inline long ix_get(hashtable_t *ht, unsigned long i) {
+  switch (ht->ix_width) {
+  case 1:
+    return ((int8_t *)ht->index)[i];
+  case 2:
+    return ((int16_t *)ht->index)[i];
+  default:
+    return ((int32_t *)ht->index)[i];
+  }
+}
+
+static inline void ix_set(hashtable_t *ht, unsigned long i, long ix) {
+  switch (ht->ix_width) {
+  case 1:
+    ((int8_t *)ht->index)[i] = ix;
+    break;
+  case 2:
+    ((int16_t *)ht->index)[i] = ix;
+    break;
+  default:
+    ((int32_t *)ht->index)[i] = ix;
+  }
+}
+
+/* the first index slot for h, and the ones after it */
+#define PROBE_START(ht, h, i, perturb) \
+  (perturb = (h), i = (h) & ((ht)->size - 1))
+#define PROBE_NEXT(ht, i, perturb) \
+  (perturb >>= 5, i = (i * 5 + perturb + 1) & ((ht)->size - 1))
+
+/* an index of size slots for up to 2/3 as many entries; every slot
+   empty (-1 in any width is all ones) */
+static void alloc_index(hashtable_t *ht, unsigned long size) {
+  ht->size = size;
+  ht->usable = size * 2 / 3;
+  ht->ix_width = size <= 0x80 ? 1 : size <= 0x8000 ? 2 : 4;
+  ht->index = malloc(size * ht->ix_width);
+  memset(ht->index, 0xff, size * ht->ix_width);
+  ht->entries = malloc(sizeof(entry_t) * (ht->usable ? ht->usable : 1));
+  ht->nentries = 0;
+  ht->allocs += 2;
+  memset(ht->stats.hist, 0, sizeof(ht->stats.hist));
+  ht->stats.total_len = 0;
+}
+
+/* entries by probe length, for ht_stats */
+static void hist_add(hashtable_t *ht, unsigned long len, long d) {
+  ht->stats.hist[len < HT_HIST_LEN - 1 ? len : HT_HIST_LEN - 1] += d;
+  ht->stats.total_len += d * len;
+}
+
+/* smallest index with room for n entries */
+static unsigned long index_size(unsigned long n) {
+  unsigned long size = 8;
+  while (size * 2 / 3 < n)
+    size <<= 1;
+  return size;
+}
+
+/* index slot for an entry known not to be present, which is counted in
+   the histogram there */
+static unsigned long empty_slot(hashtable_t *ht, unsigned long h) {
+  unsigned long i, perturb, n = 1;
+  for (PROBE_START(ht, h, i, perturb); ix_get(ht, i) != HT_IX_EMPTY;
+       PROBE_NEXT(ht, i, perturb))
+    n++;
+  hist_add(ht, n, 1);
+  return i;
+}
+
+/* copies the live entries, in order, into a fresh index of newsize */
+static void resize(hashtable_t *ht, unsigned long newsize) {
+  entry_t *old = ht->entries;
+  unsigned long i, n = ht->nentries;
+
+  free(ht->index);
+  alloc_index(ht, newsize);
+  for (i=0; i<n; i++) {
+    if (i == ht->scan_pos)
+      ht->scan_pos = ht->nentries;
+    if (old[i].key) {
+      ht->entries[ht->nentries] = old[i];
+      ix_set(ht, empty_slot(ht, old[i].hash), ht->nentries++);
+    }
+  }
+  free(old);
+}
+
+hashtable_t *make_hashtable(unsigned long size) {
+  return make_hashtable_cfg(size, NULL);
+}
+
+/* like open addressing, this table sizes itself, so only the hash
+   function and seed are taken from cfg */
+hashtable_t *make_hashtable_cfg(unsigned long size, const ht_config_t *cfg) {
+  hashtable_t *ht = calloc(1, sizeof(hashtable_t));
+  ht->allocs = 1;
+  alloc_index(ht, index_size(size));
+  ht->hashfn = cfg && cfg->hashfn ? cfg->hashfn : hash_sip;
+  if (ht->hashfn == hash_djb)
+    ht->hashfn = NULL;          /* hash() itself */
+  ht->seed = cfg && cfg->seed ? cfg->seed : hash_random_seed();
+  return ht;
+}
+
+/* entry number of key, or -1; *slot is set to its index slot */
+static long find(hashtable_t *ht, const char *key, unsigned long h,
+                 unsigned long *slot) {
+  unsigned long i, perturb;
+  long ix;
+
+  for (PROBE_START(ht, h, i, perturb); (ix = ix_get(ht, i)) != HT_IX_EMPTY;
+       PROBE_NEXT(ht, i, perturb)) {
+    if (ix >= 0 && ht->entries[ix].hash == h
+        && strcmp(ht->entries[ix].key, key) == 0) {
+      *slot = i;
+      return ix;
+    }
+  }
+  return -1;
+}
+
+/* appends an entry known not to be present, returning its number */
+static long append(hashtable_t *ht, char *key, void *val, unsigned long h) {
+  entry_t *e;
+  if (ht->nentries == ht->usable)
+    resize(ht, index_size(ht->count * 3 / 2 + 1));
+  e = &ht->entries[ht->nentries];
+  e->hash = h;
+  e->key = key;
+  e->val = val;
+  ix_set(ht, empty_slot(ht, h), ht->nentries);
+  ht->count++;
+  return ht->nentries++;
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  unsigned long h = key_hash(ht, key), slot;
+  long ix = find(ht, key, h, &slot);
+
+  if (ix >= 0) {
+    free(ht->entries[ix].val);
+    free(key);
+    ht->entries[ix].val = val;
+    ht->stats.put_hits++;
+    return;
+  }
+  append(ht, key, val, h);
+  ht->stats.put_misses++;
+}
+
+/* no arena here; the table just takes copies */
+void ht_put_str(hashtable_t *ht, const char *key, const char *val) {
+  ht_put(ht, strdup(key), strdup(val));
+  ht->allocs += 2;
+}
+
+void *ht_get(hashtable_t *ht, char *key) {
+  unsigned long slot;
+  long ix = find(ht, key, key_hash(ht, key), &slot);
+  if (ix < 0) {
+    ht->stats.get_misses++;
+    return NULL;
+  }
+  ht->stats.get_hits++;
+  return ht->entries[ix].val;
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  unsigned long slot;
+  long ix = find(ht, key, key_hash(ht, key), &slot);
+
+  if (ix < 0) {
+    ht->stats.del_misses++;
+    return;
+  }
+  ht->stats.del_hits++;
+  hist_add(ht, ht_probe_len(ht, ix), -1);
+  free(ht->entries[ix].key);
+  free(ht->entries[ix].val);
+  ht->entries[ix].key = NULL;
+  ix_set(ht, slot, HT_IX_DUMMY);
+  ht->count--;
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+  unsigned long i;
+  for (i=0; i<ht->nentries; i++) {
+    if (ht->entries[i].key && !f(ht->entries[i].key, ht->entries[i].val)) {
+      return ; // abort iteration
+    }
+  }
+}
+
+void ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals) {
+  unsigned long i;
+  for (i=0; i<n; i++)
+    vals[i] = ht_get(ht, keys[i]);
+}
+
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  unsigned long i;
+  for (i=0; i<n; i++)
+    ht_put(ht, keys[i], vals[i]);
+}
+
+/* holes are left as ht_del leaves them, but the index is rebuilt once
+   at the end rather than marked slot by slot, smaller if the table is
+   now under 1/8 full */
+unsigned long ht_purge(hashtable_t *ht, int (*pred)(char *, void *, void *),
+                       void *ctx) {
+  unsigned long i, removed = 0;
+  entry_t *e;
+
+  for (i=0; i<ht->nentries; i++) {
+    e = &ht->entries[i];
+    if (e->key && pred(e->key, e->val, ctx)) {
+      free(e->key);
+      free(e->val);
+      e->key = NULL;
+      ht->count--;
+      removed++;
+    }
+  }
+  if (removed)
+    resize(ht, ht->count * 8 < ht->size ? index_size(ht->count * 3 / 2 + 1)
+           : ht->size);
+  return removed;
+}
+
+/* newsize is taken as a number of entries to make room for */
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+  resize(ht, index_size(newsize > ht->count ? newsize : ht->count));
+}
+
+void ht_rehash_parallel(hashtable_t *ht, unsigned long newsize,
+                        unsigned long nthreads) {
+  ht_rehash(ht, newsize);
+}
+
+void **ht_get_or_insert(hashtable_t *ht, const char *key) {
+  unsigned long h = key_hash(ht, key), slot;
+  long ix = find(ht, key, h, &slot);
+
+  if (ix < 0) {
+    ix = append(ht, strdup(key), NULL, h);
+    ht->allocs++;
+    ht->stats.put_misses++;
+  } else {
+    ht->stats.put_hits++;
+  }
+  return &ht->entries[ix].val;
+}
+
+void ht_upsert(hashtable_t *ht, const char *key,
+               void (*fn)(void **val, void *ctx), void *ctx) {
+  fn(ht_get_or_insert(ht, key), ctx);
+}
+
+/* The cursor is an entry number, and a resize squeezes out the holes
+   before it. So the table remembers the cursor it last returned and
+   moves it along with its entry; the scan that cursor belongs to then
+   carries on where it was, though another run alongside it may not. */
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor,
+                      unsigned long count, void (*fn)(char *, void *)) {
+  if (cursor && cursor == ht->scan_cursor)
+    cursor = ht->scan_pos;
+  for (; cursor < ht->nentries && count--; cursor++)
+    if (ht->entries[cursor].key)
+      fn(ht->entries[cursor].key, ht->entries[cursor].val);
+  if (cursor >= ht->nentries)
+    cursor = 0;
+  ht->scan_cursor = ht->scan_pos = cursor;
+  return cursor;
+}
+
+/* no cache mode: entries live until deleted, and nothing is counted */
+void ht_put_ttl(hashtable_t *ht, char *key, void *val, unsigned long ttl_ms) {
+  ht_put(ht, key, val);
+}
+
+unsigned long ht_expire(hashtable_t *ht, unsigned long nbuckets) {
+  return 0;
+}
+
+void ht_cache_stats(hashtable_t *ht, ht_cache_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->count = ht->count;
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+  unsigned long n;
+
+  *out = ht->stats;
+  out->count = ht->count;
+  out->size = ht->size;
+  out->load = (double)ht->count / ht->size;
+  for (n = HT_HIST_LEN - 1; n > 0 && !out->hist[n]; n--)
+    ;
+  out->max_len = n;
+  out->bytes = sizeof(hashtable_t) + ht->size * ht->ix_width
+    + ht->usable * sizeof(entry_t);
+}
+
+/* number of index slots examined to reach entry ix */
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long ix) {
+  unsigned long i, perturb, n = 1;
+  for (PROBE_START(ht, ht->entries[ix].hash, i, perturb);
+       ix_get(ht, i) != (long)ix; PROBE_NEXT(ht, i, perturb))
+    n++;
+  return n;
+}
+
+void free_hashtable(hashtable_t *ht) {
+  unsigned long i;
+  for (i=0; i<ht->nentries; i++) {
+    if (ht->entries[i].key) {
+      free(ht->entries[i].key);
+      free(ht->entries[i].val);
+    }
+  }
+  free(ht->index);
+  free(ht->entries);
+  free(ht);
+}
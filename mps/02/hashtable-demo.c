@@ -18,9 +18,16 @@ hashtable_t *make_hashtable(unsigned long size) {
   return NULL;
 }
 
+hashtable_t *make_hashtable_cfg(unsigned long size, const ht_config_t *cfg) {
+  return NULL;
+}
+
 void ht_put(hashtable_t *ht, char *key, void *val) {
 }
 
+void ht_put_str(hashtable_t *ht, const char *key, const char *val) {
+}
+
 void *ht_get(hashtable_t *ht, char *key) {
   return NULL;
 }
@@ -36,3 +43,9 @@ void ht_rehash(hashtable_t *ht, unsigned long newsize) {
 
 void free_hashtable(hashtable_t *ht) {
 }
+
+void ht_cache_stats(hashtable_t *ht, ht_cache_stats_t *out) {
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+}
@@ -0,0 +1,417 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hashtable.h"
+
+/* Open-addressed hashtable: a flat slot array plus one control byte per
+   slot. A lookup hashes once, then scans the control bytes of a group of
+   HT_GROUP slots in one SSE2 compare; only slots whose 7-bit tag matches
+   are compared with strcmp. Probing moves to the next group until a group
+   containing an empty slot is seen. */
+
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+/* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
+   See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
+unsigned long hash(char *str) {
+  unsigned long hash = 5381;
+  int c;
+
+  while ((c = *str++))
+    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+
+  return hash;
+}
+
+/* DJB leaves the high bits empty for short keys, and the tag comes from
+   the high bits, so spread them with a 64-bit finalizer first. */
+static unsigned long mix(unsigned long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline unsigned char tag(unsigned long h) {
+  return h >> 57;
+}
+
+static inline unsigned long home_group(hashtable_t *ht, unsigned long h) {
+  return h & (ht->size / HT_GROUP - 1);
+}
+
+/* bit i of the result is set iff ctrl[i] == b */
+static inline unsigned int match(const unsigned char *ctrl, unsigned char b) {
+#ifdef __SSE2__
+  __m128i g = _mm_load_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#else
+  unsigned int i, m = 0;
+  for (i=0; i<HT_GROUP; i++)
+    if (ctrl[i] == b)
+      m |= 1u << i;
+  return m;
+#endif
+}
+
+/* bit i of the result is set iff slot i is empty or deleted */
+static inline unsigned int match_free(const unsigned char *ctrl) {
+#ifdef __SSE2__
+  __m128i g = _mm_load_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(g); /* both have the high bit set */
+#else
+  unsigned int i, m = 0;
+  for (i=0; i<HT_GROUP; i++)
+    if (ctrl[i] & 0x80)
+      m |= 1u << i;
+  return m;
+#endif
+}
+
+/* a power of two groups, so that a resize splits or merges home groups
+   and ht_scan's cursor stays good */
+static unsigned long round_size(unsigned long size) {
+  unsigned long n = HT_GROUP;
+  while (n < size)
+    n <<= 1;
+  return n;
+}
+
+static void alloc_slots(hashtable_t *ht, unsigned long size) {
+  void *ctrl;
+  ht->size = round_size(size);
+  ht->count = 0;
+  ht->deleted = 0;
+  memset(ht->stats.hist, 0, sizeof(ht->stats.hist));
+  ht->stats.total_len = 0;
+  if (posix_memalign(&ctrl, HT_GROUP, ht->size) != 0)
+    abort();
+  ht->ctrl = ctrl;
+  memset(ht->ctrl, HT_EMPTY, ht->size);
+  ht->slots = malloc(sizeof(slot_t) * ht->size);
+  ht->allocs += 2;
+}
+
+hashtable_t *make_hashtable(unsigned long size) {
+  return make_hashtable_cfg(size, NULL);
+}
+
+/* open addressing always resizes itself to stay under 7/8 full, and has
+   no chains to index, so only the hash function and seed are taken from
+   cfg */
+hashtable_t *make_hashtable_cfg(unsigned long size, const ht_config_t *cfg) {
+  hashtable_t *ht = calloc(1, sizeof(hashtable_t));
+  ht->allocs = 1;
+  alloc_slots(ht, size);
+  ht->hashfn = cfg && cfg->hashfn ? cfg->hashfn : hash_sip;
+  if (ht->hashfn == hash_djb)
+    ht->hashfn = NULL;          /* hash() itself */
+  ht->seed = cfg && cfg->seed ? cfg->seed : hash_random_seed();
+  return ht;
+}
+
+static unsigned long key_hash(hashtable_t *ht, char *key) {
+  if (ht->hashfn)
+    return mix(ht->hashfn(key, strlen(key), ht->seed));
+  return mix(hash(key));
+}
+
+/* returns the slot index holding key, or -1 */
+/* entries by probe length, as ht_probe_len counts it, for ht_stats */
+static void hist_add(hashtable_t *ht, unsigned long idx, long d) {
+  unsigned long len = ht_probe_len(ht, idx);
+  ht->stats.hist[len < HT_HIST_LEN - 1 ? len : HT_HIST_LEN - 1] += d;
+  ht->stats.total_len += d * len;
+}
+
+static long find(hashtable_t *ht, char *key, unsigned long h) {
+  unsigned long ngroups = ht->size / HT_GROUP;
+  unsigned long g = home_group(ht, h), probes;
+  unsigned char t = tag(h);
+  unsigned int m;
+
+  for (probes=0; probes<ngroups; probes++) {
+    const unsigned char *ctrl = ht->ctrl + g * HT_GROUP;
+    for (m = match(ctrl, t); m; m &= m - 1) {
+      slot_t *s = &ht->slots[g * HT_GROUP + __builtin_ctz(m)];
+      if (s->hash == h && strcmp(s->key, key) == 0)
+        return g * HT_GROUP + __builtin_ctz(m);
+    }
+    if (match(ctrl, HT_EMPTY))
+      return -1;
+    if (++g == ngroups)
+      g = 0;
+  }
+  return -1;
+}
+
+/* places an entry known not to be present, returning its slot index; the
+   caller ensures there is room */
+static unsigned long insert(hashtable_t *ht, char *key, void *val,
+                            unsigned long h) {
+  unsigned long ngroups = ht->size / HT_GROUP;
+  unsigned long g = home_group(ht, h), idx;
+  unsigned int m;
+
+  while (!(m = match_free(ht->ctrl + g * HT_GROUP)))
+    if (++g == ngroups)
+      g = 0;
+  idx = g * HT_GROUP + __builtin_ctz(m);
+  if (ht->ctrl[idx] == HT_DELETED)
+    ht->deleted--;
+  ht->ctrl[idx] = tag(h);
+  ht->slots[idx].key = key;
+  ht->slots[idx].val = val;
+  ht->slots[idx].hash = h;
+  ht->count++;
+  hist_add(ht, idx, 1);
+  return idx;
+}
+
+static void resize(hashtable_t *ht, unsigned long newsize) {
+  unsigned char *ctrl = ht->ctrl;
+  slot_t *slots = ht->slots;
+  unsigned long i, oldsize = ht->size;
+
+  alloc_slots(ht, newsize);
+  for (i=0; i<oldsize; i++)
+    if (!(ctrl[i] & 0x80))
+      insert(ht, slots[i].key, slots[i].val, slots[i].hash);
+  free(ctrl);
+  free(slots);
+}
+
+/* before an insert: keeps the table under 7/8 full, counting tombstones */
+static void make_room(hashtable_t *ht) {
+  if ((ht->count + ht->deleted + 1) * MAX_LOAD_DEN > ht->size * MAX_LOAD_NUM) {
+    /* grow if genuinely full, otherwise just sweep out the tombstones */
+    if ((ht->count + 1) * MAX_LOAD_DEN * 2 > ht->size * MAX_LOAD_NUM)
+      resize(ht, ht->size * 2);
+    else
+      resize(ht, ht->size);
+  }
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  unsigned long h = key_hash(ht, key);
+  long idx = find(ht, key, h);
+
+  if (idx >= 0) {
+    free(ht->slots[idx].val);
+    free(key);
+    ht->slots[idx].val = val;
+    ht->stats.put_hits++;
+    return;
+  }
+  make_room(ht);
+  insert(ht, key, val, h);
+  ht->stats.put_misses++;
+}
+
+void **ht_get_or_insert(hashtable_t *ht, const char *key) {
+  unsigned long h = key_hash(ht, (char *)key);
+  long idx = find(ht, (char *)key, h);
+
+  if (idx < 0) {
+    make_room(ht);
+    idx = insert(ht, strdup(key), NULL, h);
+    ht->allocs++;
+    ht->stats.put_misses++;
+  } else {
+    ht->stats.put_hits++;
+  }
+  return &ht->slots[idx].val;
+}
+
+void ht_upsert(hashtable_t *ht, const char *key,
+               void (*fn)(void **val, void *ctx), void *ctx) {
+  fn(ht_get_or_insert(ht, key), ctx);
+}
+
+/* no arena here; the table just takes copies */
+void ht_put_str(hashtable_t *ht, const char *key, const char *val) {
+  ht_put(ht, strdup(key), strdup(val));
+  ht->allocs += 2;
+}
+
+void *ht_get(hashtable_t *ht, char *key) {
+  long idx = find(ht, key, key_hash(ht, key));
+  if (idx < 0) {
+    ht->stats.get_misses++;
+    return NULL;
+  }
+  ht->stats.get_hits++;
+  return ht->slots[idx].val;
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  long idx = find(ht, key, key_hash(ht, key));
+  unsigned char *group;
+
+  if (idx < 0) {
+    ht->stats.del_misses++;
+    return;
+  }
+  ht->stats.del_hits++;
+  hist_add(ht, idx, -1);
+  free(ht->slots[idx].key);
+  free(ht->slots[idx].val);
+  /* a probe only continues past a group with no empty slot, so if this
+     group still has one, no chain runs through here and the slot can be
+     marked empty rather than deleted */
+  group = ht->ctrl + idx / HT_GROUP * HT_GROUP;
+  if (match(group, HT_EMPTY)) {
+    ht->ctrl[idx] = HT_EMPTY;
+  } else {
+    ht->ctrl[idx] = HT_DELETED;
+    ht->deleted++;
+  }
+  ht->count--;
+}
+
+/* each doomed slot is emptied as ht_del would, then the table shrinks if
+   it is now under 1/8 full */
+unsigned long ht_purge(hashtable_t *ht, int (*pred)(char *, void *, void *),
+                       void *ctx) {
+  unsigned long i, removed = 0;
+
+  for (i=0; i<ht->size; i++) {
+    if ((ht->ctrl[i] & 0x80) || !pred(ht->slots[i].key, ht->slots[i].val, ctx))
+      continue;
+    hist_add(ht, i, -1);
+    free(ht->slots[i].key);
+    free(ht->slots[i].val);
+    if (match(ht->ctrl + i / HT_GROUP * HT_GROUP, HT_EMPTY)) {
+      ht->ctrl[i] = HT_EMPTY;
+    } else {
+      ht->ctrl[i] = HT_DELETED;
+      ht->deleted++;
+    }
+    ht->count--;
+    removed++;
+  }
+  if (ht->count * 8 < ht->size && ht->size > HT_GROUP)
+    ht_rehash(ht, ht->count * 2 * MAX_LOAD_DEN / MAX_LOAD_NUM + 1);
+  return removed;
+}
+
+static unsigned long reverse_bits(unsigned long v) {
+  v = ((v >> 1) & 0x5555555555555555UL) | ((v & 0x5555555555555555UL) << 1);
+  v = ((v >> 2) & 0x3333333333333333UL) | ((v & 0x3333333333333333UL) << 2);
+  v = ((v >> 4) & 0x0f0f0f0f0f0f0f0fUL) | ((v & 0x0f0f0f0f0f0f0f0fUL) << 4);
+  return __builtin_bswap64(v);
+}
+
+/* Resizes re-probe everything, so slots mean nothing to a cursor; home
+   groups do. The cursor is a home group, stepped in reverse-bit order as
+   in the chained table, and each step visits the entries whose probes
+   start there: they sit in that group or the ones after it, up to the
+   first with an empty slot. A resize splits or merges home groups and a
+   sweep of tombstones keeps them, so nothing is skipped. */
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor,
+                      unsigned long count, void (*fn)(char *, void *)) {
+  unsigned long ngroups = ht->size / HT_GROUP, mask = ngroups - 1, g, n, i;
+
+  while (count--) {
+    for (g = cursor & mask, n = 0; n < ngroups; n++, g = (g + 1) & mask) {
+      for (i = g * HT_GROUP; i < (g + 1) * HT_GROUP; i++)
+        if (!(ht->ctrl[i] & 0x80) &&
+            home_group(ht, ht->slots[i].hash) == (cursor & mask))
+          fn(ht->slots[i].key, ht->slots[i].val);
+      if (match(ht->ctrl + g * HT_GROUP, HT_EMPTY))
+        break;
+    }
+    cursor = reverse_bits(reverse_bits(cursor | ~mask) + 1);
+    if (cursor == 0)
+      break;
+  }
+  return cursor;
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+  unsigned long i;
+  for (i=0; i<ht->size; i++) {
+    if (!(ht->ctrl[i] & 0x80) && !f(ht->slots[i].key, ht->slots[i].val)) {
+      return ; // abort iteration
+    }
+  }
+}
+
+/* the control bytes already keep most lookups to one group, so the
+   batched calls are plain loops here */
+void ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals) {
+  unsigned long i;
+  for (i=0; i<n; i++)
+    vals[i] = ht_get(ht, keys[i]);
+}
+
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  unsigned long i;
+  for (i=0; i<n; i++)
+    ht_put(ht, keys[i], vals[i]);
+}
+
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+  unsigned long min = ht->count * MAX_LOAD_DEN / MAX_LOAD_NUM + 1;
+  resize(ht, newsize > min ? newsize : min);
+}
+
+/* no cache mode: entries live until deleted, and nothing is counted */
+void ht_put_ttl(hashtable_t *ht, char *key, void *val, unsigned long ttl_ms) {
+  ht_put(ht, key, val);
+}
+
+unsigned long ht_expire(hashtable_t *ht, unsigned long nbuckets) {
+  return 0;
+}
+
+void ht_cache_stats(hashtable_t *ht, ht_cache_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->count = ht->count;
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+  unsigned long n;
+
+  *out = ht->stats;
+  out->count = ht->count;
+  out->size = ht->size;
+  out->load = (double)ht->count / ht->size;
+  for (n = HT_HIST_LEN - 1; n > 0 && !out->hist[n]; n--)
+    ;
+  out->max_len = n;
+  out->bytes = sizeof(hashtable_t) + ht->size * (1 + sizeof(slot_t));
+}
+
+/* resizing walks the control bytes and re-probes every entry into fresh
+   arrays; it is done on one thread here */
+void ht_rehash_parallel(hashtable_t *ht, unsigned long newsize,
+                        unsigned long nthreads) {
+  ht_rehash(ht, newsize);
+}
+
+/* number of groups examined to reach the entry in slot idx */
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long idx) {
+  unsigned long ngroups = ht->size / HT_GROUP;
+  unsigned long home = home_group(ht, ht->slots[idx].hash);
+  unsigned long g = idx / HT_GROUP;
+  return (g + ngroups - home) % ngroups + 1;
+}
+
+void free_hashtable(hashtable_t *ht) {
+  unsigned long i;
+  for (i=0; i<ht->size; i++) {
+    if (!(ht->ctrl[i] & 0x80)) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  free(ht->ctrl);
+  free(ht->slots);
+  free(ht);
+}
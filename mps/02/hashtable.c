@@ -1,7 +1,32 @@
+#define _GNU_SOURCE             /* tdestroy */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <search.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "hashtable.h"
 
+/* old buckets moved per operation while an automatic resize is underway,
+   and how many empty ones we are willing to skip over in doing so */
+#define MIGRATE_STEP  4
+#define MIGRATE_EMPTY (MIGRATE_STEP * 10)
+
+/* buckets ht_expire looks through on each put to a cache with TTLs */
+#define SWEEP_STEP    4
+
+/* the tail of a node in cache mode, at ht->lru_off */
+struct lru {
+  bucket_t *prev, *next;        /* recency list, most recent first */
+  unsigned long expires;        /* now_ns() deadline, 0 = never */
+};
+
 /* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
    See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
 unsigned long hash(char *str) {
@@ -14,110 +39,1864 @@ unsigned long hash(char *str) {
   return hash;
 }
 
+/* hashes key with the table's hash function, also returning the key
+   length so entries can be compared on hash and length before their key
+   bytes are touched; the default hash does both in one pass */
+static unsigned long hash_len(hashtable_t *ht, const char *key,
+                              unsigned long *len) {
+  const unsigned char *p = (const unsigned char *)key;
+  unsigned long hash = 5381;
+  int c;
+
+  if (ht->hashfn) {
+    *len = strlen(key);
+    return ht->hashfn(key, *len, ht->seed);
+  }
+  while ((c = *p++))
+    hash = ((hash << 5) + hash) + c;
+  *len = p - (const unsigned char *)key - 1;
+  return hash;
+}
+
+static unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
 hashtable_t *make_hashtable(unsigned long size) {
-  hashtable_t *ht = malloc(sizeof(hashtable_t));
-  ht->size = size;
+  return make_hashtable_cfg(size, NULL);
+}
+
+/* a fresh, empty bucket array of size buckets, and its lengths */
+static void alloc_buckets(hashtable_t *ht, unsigned long size) {
   ht->buckets = calloc(sizeof(bucket_t *), size);
+  ht->lens = calloc(1, size);
+  ht->size = size;
+  ht->stats.hist[0] += size;
+  ht->allocs += 2;
+}
+
+/* Front cache. Each set holds FRONT_WAYS nodes that ht_get found in
+   their chains, a hit moving a node one way forward, with a sketch of
+   their keys made from the length and the first and last 8 bytes, which
+   costs the same however long the key. A hit is
+   confirmed against the node's own key and its value read from the node,
+   so a put that replaces a value needs no invalidation here; a node is
+   dropped from the cache before it is freed, or its entry moved to
+   another node. */
+#define FRONT_WAYS 2
+
+struct ht_front {
+  unsigned long sketch;
+  bucket_t *node;
+};
+
+/* Chain lengths, for the histogram in ht->stats. A length that reaches
+   LEN_SAT stays there, the histogram's last column covering it either
+   way, until the chain next shrinks and is walked to count it again. */
+#define LEN_SAT 255
+
+static inline unsigned long hist_col(unsigned long n) {
+  return n < HT_HIST_LEN - 1 ? n : HT_HIST_LEN - 1;
+}
+
+static void set_len(hashtable_t *ht, unsigned char *l, unsigned long n) {
+  if (n > LEN_SAT)
+    n = LEN_SAT;
+  ht->stats.hist[hist_col(*l)]--;
+  ht->stats.hist[hist_col(n)]++;
+  *l = n;
+}
+
+/* the length of the chain at head, in whichever array it is */
+static unsigned char *chain_len(hashtable_t *ht, bucket_t **head) {
+  if (ht->old_buckets
+      && (head < ht->buckets || head >= ht->buckets + ht->size))
+    return &ht->old_lens[head - ht->old_buckets];
+  return &ht->lens[head - ht->buckets];
+}
+
+static void chain_grew(hashtable_t *ht, bucket_t **head) {
+  unsigned char *l = chain_len(ht, head);
+  if (*l < LEN_SAT)
+    set_len(ht, l, *l + 1);
+}
+
+static void chain_shrank(hashtable_t *ht, bucket_t **head) {
+  unsigned char *l = chain_len(ht, head);
+  unsigned long n = 0;
+  bucket_t *b;
+
+  if (*l < LEN_SAT) {
+    set_len(ht, l, *l - 1);
+    return;
+  }
+  for (b = *head; b; b = b->next)
+    n++;
+  set_len(ht, l, n);
+}
+
+hashtable_t *make_hashtable_cfg(unsigned long size, const ht_config_t *cfg) {
+  hashtable_t *ht = calloc(1, sizeof(hashtable_t));
+  unsigned long node;
+  ht->allocs = 1;
+  alloc_buckets(ht, size);
+  ht->min_size = size;
+  ht->inline_keys = !(cfg && cfg->no_inline);
+  node = ht->inline_keys ? sizeof(bucket_t)
+    : offsetof(bucket_t, key) + sizeof(char *);
+  if (cfg && (cfg->capacity || cfg->ttl_ms)) {
+    ht->lru_off = node;
+    ht->capacity = cfg->capacity;
+    ht->ttl_ns = cfg->ttl_ms * 1000000UL;
+    node += sizeof(struct lru);
+  }
+  slab_init(&ht->nodes, node);
+  arena_init(&ht->strings);
+  ht->seed = hash_random_seed();
+  ht->hashfn = hash_sip;
+  if (cfg) {
+    ht->max_load = cfg->max_load;
+    ht->min_load = cfg->min_load;
+    if (cfg->hashfn)
+      ht->hashfn = cfg->hashfn == hash_djb ? NULL : cfg->hashfn;
+    ht->tree_bins = cfg->tree_bins;
+    if (cfg->seed)
+      ht->seed = cfg->seed;
+    if ((ht->bloom_bits = cfg->bloom_bits))
+      bloom_init(&ht->bloom, size * ht->bloom_bits, ht->bloom_bits);
+    if (cfg->front_slots && !ht->lru_off) {
+      for (ht->front_mask = 1; ht->front_mask * FRONT_WAYS < cfg->front_slots;
+           ht->front_mask <<= 1)
+        ;
+      ht->front = calloc(ht->front_mask, sizeof(struct ht_front) * FRONT_WAYS);
+      ht->front_mask--;
+      ht->allocs++;
+    }
+  }
   return ht;
 }
 
-void ht_put(hashtable_t *ht, char *key, void *val) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
+static inline char *bucket_key(bucket_t *b) {
+  return (b->flags & HT_KEY_INLINE) ? b->ikey : b->key;
+}
+
+/* whether the table must free() b's key */
+static inline int key_on_heap(bucket_t *b) {
+  return !(b->flags & (HT_KEY_ARENA | HT_KEY_INLINE));
+}
+
+static inline unsigned long sketch(const char *key, unsigned long len) {
+  unsigned long a = 0, b = 0, h;
+  memcpy(&a, key, len < 8 ? len : 8);
+  if (len > 8)
+    memcpy(&b, key + len - 8, 8);
+  h = (a ^ ((b << 29) | (b >> 35)) ^ len) * 0x9e3779b97f4a7c15UL;
+  return h ^ (h >> 29);
+}
+
+static inline struct ht_front *front_set(hashtable_t *ht, unsigned long sk) {
+  return ht->front + ((sk >> 32) & ht->front_mask) * FRONT_WAYS;
+}
+
+static bucket_t *front_find(hashtable_t *ht, const char *key,
+                            unsigned long len, unsigned long sk) {
+  struct ht_front *set = front_set(ht, sk), tmp;
+  bucket_t *b;
+  int i;
+
+  for (i=0; i<FRONT_WAYS; i++) {
+    b = set[i].node;
+    if (b && set[i].sketch == sk && b->klen == len
+        && memcmp(bucket_key(b), key, len) == 0) {
+      if (i > 0) {
+        tmp = set[i - 1];
+        set[i - 1] = set[i];
+        set[i] = tmp;
+      }
+      return b;
+    }
+  }
+  return NULL;
+}
+
+/* a new node goes in the last way, so that it must be found again before
+   it can push out one that has been */
+static void front_add(hashtable_t *ht, unsigned long sk, bucket_t *b) {
+  struct ht_front *set = front_set(ht, sk);
+  set[FRONT_WAYS - 1].sketch = sk;
+  set[FRONT_WAYS - 1].node = b;
+}
+
+static void front_forget(hashtable_t *ht, bucket_t *b) {
+  struct ht_front *set = front_set(ht, sketch(bucket_key(b), b->klen));
+  int i;
+
+  for (i=0; i<FRONT_WAYS; i++)
+    if (set[i].node == b)
+      set[i].node = NULL;
+}
+
+/* Tree bins. A tree indexes the nodes of one chain of the current bucket
+   array, which stays linked as before, so iteration, migration and the
+   stats never see the trees. Resizing drops every tree, and the chains
+   that are still long are indexed again as lookups come across them. */
+
+static int tree_cmp(const void *pa, const void *pb) {
+  const bucket_t *a = pa, *b = pb;
+  if (a->hash != b->hash)
+    return a->hash < b->hash ? -1 : 1;
+  if (a->klen != b->klen)
+    return a->klen < b->klen ? -1 : 1;
+  return memcmp(bucket_key((bucket_t *)a), bucket_key((bucket_t *)b), a->klen);
+}
+
+/* the tree root for the chain at head, if head has one */
+static void **tree_root(hashtable_t *ht, bucket_t **head) {
+  unsigned long idx = head - ht->buckets;
+  if (!ht->trees || head < ht->buckets || idx >= ht->size || !ht->trees[idx])
+    return NULL;
+  return &ht->trees[idx];
+}
+
+static void tree_add(hashtable_t *ht, bucket_t **head, bucket_t *b) {
+  void **root = tree_root(ht, head);
+  if (root)
+    tsearch(b, root, tree_cmp);
+}
+
+static void no_free(void *p) {
+}
+
+static void drop_trees(hashtable_t *ht) {
+  unsigned long i;
+  if (!ht->trees)
+    return;
+  for (i=0; i<ht->size; i++)
+    if (ht->trees[i])
+      tdestroy(ht->trees[i], no_free);
+  free(ht->trees);
+  ht->trees = NULL;
+}
+
+static void treeify(hashtable_t *ht, bucket_t **head) {
+  unsigned long idx = head - ht->buckets;
+  bucket_t *b;
+
+  if (head < ht->buckets || idx >= ht->size)
+    return;                     /* an old bucket, about to be migrated */
+  if (!ht->trees) {
+    ht->trees = calloc(ht->size, sizeof(void *));
+    ht->allocs++;
+  }
+  for (b = *head; b; b = b->next)
+    tsearch(b, &ht->trees[idx], tree_cmp);
+}
+
+/* the node for key in the chain at head, or NULL */
+static bucket_t *find_node(hashtable_t *ht, bucket_t **head, const char *key,
+                           unsigned long h, unsigned long len) {
+  void **root, **r;
+  unsigned long n = 0;
+  bucket_t probe, *b;
+
+  if (ht->bloom_bits && !bloom_maybe(&ht->bloom, h))
+    return NULL;
+  root = ht->trees ? tree_root(ht, head) : NULL;
+  if (root) {
+    probe.hash = h;
+    probe.klen = len;
+    probe.flags = 0;
+    probe.key = (char *)key;
+    r = tfind(&probe, root, tree_cmp);
+    return r ? *r : NULL;
+  }
+  for (b = *head; b; b = b->next, n++) {
+    if (b->hash == h && b->klen == len && memcmp(bucket_key(b), key, len) == 0)
+      break;
+  }
+  if (n > HT_TREE_MIN && ht->tree_bins)
+    treeify(ht, head);
+  return b;
+}
+
+static void lru_replace(hashtable_t *ht, bucket_t *from, bucket_t *to);
+
+/* Unlinks c from the chain at head, given the link p that points to it;
+   p is NULL if c was found through a tree, in which case the head node's
+   entry is moved into c and the head node unlinked instead, to save a
+   walk along the chain. Returns the node that now holds c's entry; in
+   cache mode, c must already be off the recency list. */
+static bucket_t *unlink_entry(hashtable_t *ht, bucket_t **head,
+                              bucket_t **p, bucket_t *c) {
+  void **root = tree_root(ht, head);
+  char tmp[sizeof(bucket_t)];
+  unsigned long off = offsetof(bucket_t, hash);
+  unsigned long n = (ht->lru_off ? ht->lru_off : ht->nodes.objsize) - off;
+  bucket_t *h0 = *head;
+
+  if (!root) {
+    *p = c->next;
+    chain_shrank(ht, head);
+    return c;
+  }
+  tdelete(c, root, tree_cmp);
+  if (c != h0) {
+    tdelete(h0, root, tree_cmp);
+    if (ht->front) {
+      front_forget(ht, h0);
+      front_forget(ht, c);
+    }
+    memcpy(tmp, (char *)c + off, n);
+    memcpy((char *)c + off, (char *)h0 + off, n);
+    memcpy((char *)h0 + off, tmp, n);
+    if (ht->lru_off)
+      lru_replace(ht, h0, c);
+    tsearch(c, root, tree_cmp);
+  }
+  *head = h0->next;
+  chain_shrank(ht, head);
+  return h0;
+}
+
+/* head of the chain that holds (or would hold) a key with hash h: while a
+   resize is underway, old buckets not yet migrated are still live */
+static bucket_t **chain(hashtable_t *ht, unsigned long h) {
+  if (ht->old_buckets) {
+    unsigned long oidx = h % ht->old_size;
+    if (oidx >= ht->migrate_idx)
+      return &ht->old_buckets[oidx];
+  }
+  return &ht->buckets[h % ht->size];
+}
+
+/* link in the chain at head that points to key, or the chain's
+   terminating NULL link if key is not there */
+static bucket_t **find(bucket_t **head, const char *key,
+                       unsigned long h, unsigned long len) {
+  bucket_t **p;
+  for (p = head; *p; p = &(*p)->next) {
+    bucket_t *b = *p;
+    if (b->hash == h && b->klen == len && memcmp(bucket_key(b), key, len) == 0)
+      break;
+  }
+  return p;
+}
+
+/* moves every node of old bucket idx into the new bucket array */
+static void migrate_bucket(hashtable_t *ht, unsigned long idx) {
+  bucket_t *b = ht->old_buckets[idx], *next;
+  unsigned long nidx;
+
   while (b) {
-    if (strcmp(b->key, key) == 0) {
-	 free(b->val);
-	 free(key);
-	 b->val = val;
-	 return;
-    }  
-    b = b->next;
-  }    
-  b = malloc(sizeof(bucket_t));
-  b->key = key;
+    next = b->next;
+    nidx = b->hash % ht->size;
+    b->next = ht->buckets[nidx];
+    ht->buckets[nidx] = b;
+    chain_grew(ht, &ht->buckets[nidx]);
+    tree_add(ht, &ht->buckets[nidx], b);
+    b = next;
+  }
+  ht->old_buckets[idx] = NULL;
+  set_len(ht, &ht->old_lens[idx], 0);
+}
+
+static void finish_migration(hashtable_t *ht) {
+  free(ht->old_buckets);
+  free(ht->old_lens);
+  ht->stats.hist[0] -= ht->old_size;
+  ht->old_buckets = NULL;
+  ht->old_lens = NULL;
+  ht->old_size = 0;
+  ht->migrate_idx = 0;
+}
+
+/* one increment of an automatic resize */
+static void migrate_step(hashtable_t *ht) {
+  int moved = 0, empty = 0;
+
+  while (ht->migrate_idx < ht->old_size
+         && moved < MIGRATE_STEP && empty < MIGRATE_EMPTY) {
+    if (ht->old_buckets[ht->migrate_idx]) {
+      migrate_bucket(ht, ht->migrate_idx);
+      moved++;
+    } else {
+      empty++;
+    }
+    ht->migrate_idx++;
+  }
+  if (ht->migrate_idx == ht->old_size)
+    finish_migration(ht);
+}
+
+static void migrate_all(hashtable_t *ht) {
+  if (!ht->old_buckets)
+    return;
+  for (; ht->migrate_idx < ht->old_size; ht->migrate_idx++)
+    if (ht->old_buckets[ht->migrate_idx])
+      migrate_bucket(ht, ht->migrate_idx);
+  finish_migration(ht);
+}
+
+/* smallest power of two keeping the table at half its maximum load, or
+   half full if it does not resize itself */
+static unsigned long target_size(hashtable_t *ht) {
+  double max_load = ht->max_load > 0 ? ht->max_load : 1.0;
+  unsigned long want = (unsigned long)(ht->count * 2 / max_load) + 1;
+  unsigned long size = 1;
+
+  if (want < ht->min_size)
+    want = ht->min_size;
+  while (size < want)
+    size <<= 1;
+  return size;
+}
+
+/* starts an automatic resize if the load factor has left its bounds;
+   the entries themselves move over in later calls to migrate_step */
+static void check_load(hashtable_t *ht) {
+  unsigned long newsize;
+
+  if (ht->max_load <= 0 || ht->old_buckets)
+    return;
+  if (ht->count > ht->max_load * ht->size) {
+    newsize = target_size(ht);
+  } else if (ht->count < ht->min_load * ht->size && ht->size > ht->min_size) {
+    newsize = target_size(ht);
+    if (newsize >= ht->size)
+      return;
+  } else {
+    return;
+  }
+  drop_trees(ht);
+  ht->old_buckets = ht->buckets;
+  ht->old_lens = ht->lens;
+  ht->old_size = ht->size;
+  ht->migrate_idx = 0;
+  alloc_buckets(ht, newsize);
+  ht->resizes++;
+}
+
+/* ops that run while entries are migrating are timed, so the cost of
+   spreading a resize out can be checked against a one-shot rehash */
+static unsigned long op_begin(hashtable_t *ht) {
+  if (!ht->old_buckets)
+    return 0;
+  return now_ns();
+}
+
+static void op_end(hashtable_t *ht, unsigned long t0) {
+  unsigned long t;
+  if (!t0)
+    return;
+  t = now_ns() - t0;
+  if (t > ht->max_migrate_op_ns)
+    ht->max_migrate_op_ns = t;
+}
+
+static void *snap_get(hashtable_t *ht, const char *key,
+                      unsigned long h, unsigned long len, int *found);
+
+/* value for key given its chain entry b (NULL if absent): a key with no
+   entry may still be in the snapshot under the table */
+static void *entry_val(hashtable_t *ht, bucket_t *b, const char *key,
+                       unsigned long h, unsigned long len) {
+  if (b)
+    return b->val;              /* NULL for a tombstone */
+  if (ht->snap)
+    return snap_get(ht, key, h, len, NULL);
+  return NULL;
+}
+
+/* links a new node for a key not in the table at the head of its chain */
+static bucket_t *new_entry(hashtable_t *ht, bucket_t **head,
+                           unsigned long h, unsigned long len) {
+  bucket_t *b = slab_alloc(&ht->nodes);
+  b->hash = h;
+  b->klen = len;
+  b->next = *head;
+  *head = b;
+  chain_grew(ht, head);
+  ht->count++;
+  if (ht->bloom_bits)
+    bloom_add(&ht->bloom, h);
+  return b;
+}
+
+/* keeps a copy of key in b, in the node if it fits, else in the arena */
+static unsigned int copy_key(hashtable_t *ht, bucket_t *b, const char *key,
+                             unsigned long len) {
+  if (ht->inline_keys && len <= HT_INLINE_MAX) {
+    memcpy(b->ikey, key, len + 1);
+    return HT_KEY_INLINE;
+  }
+  b->key = arena_strdup(&ht->strings, key, len);
+  return HT_KEY_ARENA;
+}
+
+/* a new node's key may be hiding a snapshot entry */
+static unsigned int shadow_flag(hashtable_t *ht, const char *key,
+                                unsigned long h, unsigned long len) {
+  int found = 0;
+  if (ht->snap)
+    snap_get(ht, key, h, len, &found);
+  ht->shadowed += found;
+  return found ? HT_SHADOW : 0;
+}
+
+static void free_val(hashtable_t *ht, bucket_t *b) {
+  if (!(b->flags & HT_VAL_ARENA)) {
+    free(b->val);
+    ht->heap_fields--;
+  }
+}
+
+/* frees an entry already unlinked from its chain */
+static void free_entry(hashtable_t *ht, bucket_t *b) {
+  if (ht->front)
+    front_forget(ht, b);
+  if (ht->bloom_bits)
+    bloom_remove(&ht->bloom, b->hash);
+  if (key_on_heap(b)) {
+    free(b->key);
+    ht->heap_fields--;
+  }
+  free_val(ht, b);
+  slab_free(&ht->nodes, b);
+}
+
+/* Cache mode */
+
+static inline struct lru *lru(hashtable_t *ht, bucket_t *b) {
+  return (struct lru *)((char *)b + ht->lru_off);
+}
+
+static void lru_push(hashtable_t *ht, bucket_t *b) {
+  struct lru *l = lru(ht, b);
+  l->prev = NULL;
+  l->next = ht->lru_head;
+  if (ht->lru_head)
+    lru(ht, ht->lru_head)->prev = b;
+  else
+    ht->lru_tail = b;
+  ht->lru_head = b;
+}
+
+static void lru_remove(hashtable_t *ht, bucket_t *b) {
+  struct lru *l = lru(ht, b);
+  if (l->prev)
+    lru(ht, l->prev)->next = l->next;
+  else
+    ht->lru_head = l->next;
+  if (l->next)
+    lru(ht, l->next)->prev = l->prev;
+  else
+    ht->lru_tail = l->prev;
+}
+
+/* node to takes from's place in the list (and its deadline) */
+static void lru_replace(hashtable_t *ht, bucket_t *from, bucket_t *to) {
+  struct lru *l = lru(ht, to);
+  *l = *lru(ht, from);
+  if (l->prev)
+    lru(ht, l->prev)->next = to;
+  else
+    ht->lru_head = to;
+  if (l->next)
+    lru(ht, l->next)->prev = to;
+  else
+    ht->lru_tail = to;
+}
+
+static inline int expired(hashtable_t *ht, bucket_t *b, unsigned long now) {
+  unsigned long e = lru(ht, b)->expires;
+  return e && e <= now;
+}
+
+/* whether iteration should see b; now is 0 unless TTLs are in use */
+static inline int live(hashtable_t *ht, bucket_t *b, unsigned long now) {
+  return !(b->flags & HT_TOMB) && !(now && expired(ht, b, now));
+}
+
+/* unlinks and frees b, wherever it is */
+static void remove_node(hashtable_t *ht, bucket_t *b) {
+  bucket_t **head = chain(ht, b->hash), **p = head;
+
+  lru_remove(ht, b);
+  if (tree_root(ht, head)) {
+    p = NULL;
+  } else {
+    while (*p != b)
+      p = &(*p)->next;
+  }
+  free_entry(ht, unlink_entry(ht, head, p, b));
+  ht->count--;
+}
+
+unsigned long ht_expire(hashtable_t *ht, unsigned long nbuckets) {
+  unsigned long now, done = 0;
+  bucket_t *b;
+
+  if (!ht->lru_off || !ht->ttl_used)
+    return 0;
+  now = now_ns();
+  for (; nbuckets--; ht->sweep_idx++) {
+    if (ht->sweep_idx >= ht->size)
+      ht->sweep_idx = 0;
+  again:
+    for (b = ht->buckets[ht->sweep_idx]; b; b = b->next) {
+      if (expired(ht, b, now)) {
+        remove_node(ht, b);     /* may move entries between nodes */
+        done++;
+        goto again;
+      }
+    }
+  }
+  ht->expirations += done;
+  return done;
+}
+
+/* After a put to b: b is now the most recently used entry, and may have
+   pushed the table past its capacity. Entries are moved between nodes
+   when removed, so b must not be used after this. */
+static void cache_put(hashtable_t *ht, bucket_t *b, int found,
+                      unsigned long ttl_ns) {
+  if (!found)
+    lru_push(ht, b);
+  else if (ht->lru_head != b) {
+    lru_remove(ht, b);
+    lru_push(ht, b);
+  }
+  lru(ht, b)->expires = ttl_ns ? now_ns() + ttl_ns : 0;
+  if (ttl_ns)
+    ht->ttl_used = 1;
+  ht_expire(ht, SWEEP_STEP);
+  while (ht->capacity && ht->count > ht->capacity) {
+    remove_node(ht, ht->lru_tail);
+    ht->evictions++;
+  }
+}
+
+/* the result of a lookup that found b (or NULL) */
+static bucket_t *cache_lookup(hashtable_t *ht, bucket_t *b) {
+  if (b && ht->ttl_used && expired(ht, b, now_ns())) {
+    remove_node(ht, b);
+    ht->expirations++;
+    b = NULL;
+  }
+  if (!b)
+    return NULL;
+  if (ht->lru_head != b) {
+    lru_remove(ht, b);
+    lru_push(ht, b);
+  }
+  return b;
+}
+
+void ht_cache_stats(hashtable_t *ht, ht_cache_stats_t *out) {
+  out->hits = ht->stats.get_hits;
+  out->misses = ht->stats.get_misses;
+  out->evictions = ht->evictions;
+  out->expirations = ht->expirations;
+  out->count = ht->count;
+  out->capacity = ht->capacity;
+}
+
+/* a put found the key if it had a live node, or the node it now has
+   hides a snapshot entry; called before the put clears HT_TOMB */
+static void count_put(hashtable_t *ht, bucket_t *b, int found) {
+  if (found ? !(b->flags & HT_TOMB) : !!(b->flags & HT_SHADOW))
+    ht->stats.put_hits++;
+  else
+    ht->stats.put_misses++;
+}
+
+/* every count below is kept as the table changes; only max_len and
+   bytes are worked out here, neither from the entries */
+void ht_stats(hashtable_t *ht, ht_stats_t *out) {
+  unsigned long n;
+
+  *out = ht->stats;
+  out->count = ht->count;
+  out->size = ht->size + ht->old_size;
+  out->load = (double)ht->count / out->size;
+  out->total_len = ht->count;   /* a node per entry, tombstones included */
+  for (n = HT_HIST_LEN - 1; n > 0 && !out->hist[n]; n--)
+    ;
+  out->max_len = n;
+  out->bytes = sizeof(hashtable_t) + out->size * (sizeof(bucket_t *) + 1)
+    + slab_bytes(&ht->nodes) + ht->strings.held
+    + (ht->trees ? ht->size * sizeof(void *) : 0)
+    + (ht->bloom_bits ? bloom_bytes(&ht->bloom) : 0)
+    + (ht->front ? (ht->front_mask + 1) * FRONT_WAYS
+       * sizeof(struct ht_front) : 0);
+}
+
+static void put_hashed(hashtable_t *ht, char *key, void *val,
+                       unsigned long h, unsigned long len,
+                       unsigned long ttl_ns) {
+  bucket_t **head = chain(ht, h), *b;
+  int found;
+
+  if ((found = !!(b = find_node(ht, head, key, h, len)))) {
+    free_val(ht, b);
+    free(key);
+  } else {
+    b = new_entry(ht, head, h, len);
+    b->flags = shadow_flag(ht, key, h, len);
+    if (ht->inline_keys && len <= HT_INLINE_MAX) {
+      memcpy(b->ikey, key, len + 1);
+      b->flags |= HT_KEY_INLINE;
+      free(key);
+    } else {
+      b->key = key;
+      ht->heap_fields++;
+    }
+    tree_add(ht, head, b);
+  }
+  count_put(ht, b, found);
   b->val = val;
-  b->next = ht->buckets[idx];
-  ht->buckets[idx] = b;
+  b->flags &= ~(HT_VAL_ARENA | HT_TOMB);
+  ht->heap_fields++;
+  if (ht->lru_off)
+    cache_put(ht, b, found, ttl_ns);
+  check_load(ht);
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  h = hash_len(ht, key, &len);
+  put_hashed(ht, key, val, h, len, ht->ttl_ns);
+  op_end(ht, t0);
+}
+
+void ht_put_ttl(hashtable_t *ht, char *key, void *val, unsigned long ttl_ms) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  h = hash_len(ht, key, &len);
+  put_hashed(ht, key, val, h, len, ttl_ms * 1000000UL);
+  op_end(ht, t0);
+}
+
+/* like ht_put, but the table keeps its own copies of key and val, packed
+   into its string arena, and the caller keeps ownership of both */
+void ht_put_str(hashtable_t *ht, const char *key, const char *val) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len;
+  bucket_t **head, *b;
+  int found;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  h = hash_len(ht, key, &len);
+  head = chain(ht, h);
+  if ((found = !!(b = find_node(ht, head, key, h, len)))) {
+    free_val(ht, b);
+  } else {
+    b = new_entry(ht, head, h, len);
+    b->flags = copy_key(ht, b, key, len) | shadow_flag(ht, key, h, len);
+    tree_add(ht, head, b);
+  }
+  count_put(ht, b, found);
+  b->val = arena_strdup(&ht->strings, val, strlen(val));
+  b->flags = (b->flags | HT_VAL_ARENA) & ~HT_TOMB;
+  if (ht->lru_off)
+    cache_put(ht, b, found, ht->ttl_ns);
+  check_load(ht);
+  op_end(ht, t0);
+}
+
+/* Read-modify-write in one probe. The slot returned holds a value the
+   table will free(); one copied in by ht_put_str or still in a snapshot
+   is first copied to the heap, so the caller may replace it like any
+   other. A deleted or expired entry comes back as a new one. */
+void **ht_get_or_insert(hashtable_t *ht, const char *key) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len;
+  bucket_t **head, *b;
+  int found;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  h = hash_len(ht, key, &len);
+  head = chain(ht, h);
+  b = find_node(ht, head, key, h, len);
+  if (b && ht->ttl_used && expired(ht, b, now_ns())) {
+    remove_node(ht, b);         /* and inserted again below */
+    ht->expirations++;
+    b = NULL;
+  }
+  if (!(found = !!b)) {
+    b = new_entry(ht, head, h, len);
+    b->flags = copy_key(ht, b, key, len) | shadow_flag(ht, key, h, len)
+      | HT_VAL_ARENA;
+    b->val = (b->flags & HT_SHADOW) ? snap_get(ht, key, h, len, NULL) : NULL;
+    tree_add(ht, head, b);
+  }
+  count_put(ht, b, found);
+  if (b->flags & HT_VAL_ARENA) {
+    if (b->val) {
+      b->val = strdup(b->val);
+      ht->allocs++;
+    }
+    b->flags &= ~(HT_VAL_ARENA | HT_TOMB);
+    ht->heap_fields++;
+  }
+  if (ht->lru_off) {
+    cache_put(ht, b, found, ht->ttl_ns);
+    if (ht->trees)              /* evictions may have moved the entry */
+      b = find_node(ht, chain(ht, h), key, h, len);
+  }
+  check_load(ht);
+  op_end(ht, t0);
+  return &b->val;
+}
+
+void ht_upsert(hashtable_t *ht, const char *key,
+               void (*fn)(void **val, void *ctx), void *ctx) {
+  fn(ht_get_or_insert(ht, key), ctx);
 }
 
 void *ht_get(hashtable_t *ht, char *key) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
-  while (b) {
-    if (strcmp(b->key, key) == 0) {
-      return b->val;
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len, sk = 0;
+  bucket_t *b;
+  void *val;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  if (ht->front) {
+    len = strlen(key);
+    sk = sketch(key, len);
+    if ((b = front_find(ht, key, len, sk))) {
+      ht->stats.front_hits++;
+      val = b->val;
+      goto done;
     }
-    b = b->next;
+    ht->stats.front_misses++;
   }
-  return NULL;
+  h = hash_len(ht, key, &len);
+  b = find_node(ht, chain(ht, h), key, h, len);
+  if (ht->lru_off)
+    b = cache_lookup(ht, b);
+  if (b && ht->front)
+    front_add(ht, sk, b);
+  val = entry_val(ht, b, key, h, len);
+ done:
+  if (val)
+    ht->stats.get_hits++;
+  else
+    ht->stats.get_misses++;
+  op_end(ht, t0);
+  return val;
+}
+
+static int walk_snap(hashtable_t *ht, int (*f)(void *, const char *,
+                     unsigned long, unsigned long, void *), void *ctx);
+
+/* calls f(ctx, key, len, hash, val) on every live entry until f returns
+   0: chained entries, then any in the snapshot not superseded by them */
+static int walk(hashtable_t *ht, int (*f)(void *, const char *,
+                unsigned long, unsigned long, void *), void *ctx) {
+  unsigned long i, now = ht->ttl_used ? now_ns() : 0;
+  bucket_t *b;
+  for (i=0; i<ht->size; i++) {
+    for (b = ht->buckets[i]; b; b = b->next) {
+      if (live(ht, b, now)
+          && !f(ctx, bucket_key(b), b->klen, b->hash, b->val)) {
+        return 0;
+      }
+    }
+  }
+  for (i=ht->migrate_idx; i<ht->old_size; i++) {
+    for (b = ht->old_buckets[i]; b; b = b->next) {
+      if (live(ht, b, now)
+          && !f(ctx, bucket_key(b), b->klen, b->hash, b->val)) {
+        return 0;
+      }
+    }
+  }
+  return ht->snap ? walk_snap(ht, f, ctx) : 1;
+}
+
+static int iter_entry(void *ctx, const char *key, unsigned long len,
+                      unsigned long h, void *val) {
+  int (**f)(char *, void *) = ctx;
+  return (*f)((char *)key, val);
 }
 
 void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+  walk(ht, iter_entry, &f); // stops early if f returns 0
+}
+
+/* Scanning. The cursor counts through bucket indexes with its bits
+   reversed, high bit first, so with power-of-two sizes (as automatic
+   resizing keeps them) the buckets already visited at one size are
+   exactly the ones whose entries a resize would move to the buckets
+   visited at another. Each call visits the buckets at the cursor under
+   the smallest array in use, and in each larger array (the other side
+   of a migration, or a snapshot) every bucket that expands from it. */
+
+static unsigned long snap_buckets(hashtable_t *ht);
+static void scan_snap(hashtable_t *ht, unsigned long idx,
+                      void (*fn)(char *, void *));
+
+static unsigned long scan_mask(unsigned long size) {
+  unsigned long m = 1;
+  while (m < size)
+    m <<= 1;
+  return m - 1;
+}
+
+static unsigned long reverse_bits(unsigned long v) {
+  v = ((v >> 1) & 0x5555555555555555UL) | ((v & 0x5555555555555555UL) << 1);
+  v = ((v >> 2) & 0x3333333333333333UL) | ((v & 0x3333333333333333UL) << 2);
+  v = ((v >> 4) & 0x0f0f0f0f0f0f0f0fUL) | ((v & 0x0f0f0f0f0f0f0f0fUL) << 4);
+  return __builtin_bswap64(v);
+}
+
+/* the chains of buckets[lo..size) at every index i <= mask with
+   (i & m0) == (v & m0) */
+static void scan_array(hashtable_t *ht, bucket_t **buckets, unsigned long lo,
+                       unsigned long size, unsigned long mask, unsigned long v,
+                       unsigned long m0, unsigned long now,
+                       void (*fn)(char *, void *)) {
+  unsigned long i = v & m0;
   bucket_t *b;
+
+  do {
+    if (i >= lo && i < size)
+      for (b = buckets[i]; b; b = b->next)
+        if (live(ht, b, now))
+          fn(bucket_key(b), b->val);
+    i = (((i | m0) + 1) & ~m0) | (v & m0);
+  } while (i & (mask ^ m0));
+}
+
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor,
+                      unsigned long count, void (*fn)(char *, void *)) {
+  unsigned long now = ht->ttl_used ? now_ns() : 0, m0, m, om = 0, sm = 0, i;
+
+  m0 = m = scan_mask(ht->size);
+  if (ht->old_buckets && (om = scan_mask(ht->old_size)) < m0)
+    m0 = om;
+  if (ht->snap && (sm = scan_mask(snap_buckets(ht))) < m0)
+    m0 = sm;
+  while (count--) {
+    scan_array(ht, ht->buckets, 0, ht->size, m, cursor, m0, now, fn);
+    if (ht->old_buckets)
+      scan_array(ht, ht->old_buckets, ht->migrate_idx, ht->old_size, om,
+                 cursor, m0, now, fn);
+    if (ht->snap) {
+      i = cursor & m0;
+      do {
+        if (i < snap_buckets(ht))
+          scan_snap(ht, i, fn);
+        i = (((i | m0) + 1) & ~m0) | (cursor & m0);
+      } while (i & (sm ^ m0));
+    }
+
+    /* add one to the bits under m0, taken in reverse */
+    cursor = reverse_bits(reverse_bits(cursor | ~m0) + 1);
+    if (cursor == 0)
+      break;
+  }
+  return cursor;
+}
+
+static void free_chains(hashtable_t *ht, bucket_t **buckets,
+                        unsigned long size) {
   unsigned long i;
-  for (i=0; i<ht->size; i++) {
-    b = ht->buckets[i];
-    while (b) {
-      if (!f(b->key, b->val)) {
-        return ; // abort iteration
+  bucket_t *b;
+  for (i=0; i<size && ht->heap_fields; i++) {
+    for (b = buckets[i]; b; b = b->next) {
+      if (key_on_heap(b)) {
+        free(b->key);
+        ht->heap_fields--;
+      }
+      if (!(b->flags & HT_VAL_ARENA)) {
+        free(b->val);
+        ht->heap_fields--;
       }
-      b = b->next;
     }
   }
+  free(buckets);
 }
 
+/* Nodes and arena strings go back a slab at a time, so a table filled
+   only through ht_put_str is torn down without visiting its entries. */
 void free_hashtable(hashtable_t *ht) {
-        for(int i=0; i<ht->size; i++) {
-                bucket_t *b = ht->buckets[i];
-                while(b){
-                        free(b->key);
-			free(b->val);
-			bucket_t *c = b;
-			b = b->next;
-			free(c);
-                }
-        }
-	free(ht->buckets);
-	free(ht); // FIXME: must free all substructures!
-}
-
-/* TODO */
-void  ht_del(hashtable_t *ht, char *key) {
-	unsigned int idx = hash(key) % ht->size;
-	if (strcmp(ht->buckets[idx]->key,key) == 0){
-		bucket_t *c = ht->buckets[idx];
-		ht->buckets[idx] = ht->buckets[idx]->next;	
-		free(c->key);
-                free(c->val);
-                free(c);
-		return;
-	}	
-	bucket_t *b = ht->buckets[idx];
-	while(b && b->next){
-		if (strcmp(b->next->key, key) == 0){
-			bucket_t *c = b->next;
-			b->next = b->next->next;
-			free(c->key);
-			free(c->val);
-			free(c);
-			return;
-		}
-		b = b->next;
-	}
-}
-
-void  ht_rehash(hashtable_t *ht, unsigned long newsize) {
-	hashtable_t *newht = make_hashtable(newsize);
-	for(int i=0; i<ht->size; i++) {
-		bucket_t *b = ht->buckets[i];
-		while(b){
-			ht_put(newht, b->key, b->val);
-			bucket_t *c = b;
-			b = b->next;
-			free(c);
-		}
-	}
-	free(ht->buckets);
-	*ht = *newht;
-	free(newht);
+  free_chains(ht, ht->buckets, ht->size);
+  if (ht->old_buckets)
+    free_chains(ht, ht->old_buckets, ht->old_size);
+  free(ht->lens);
+  free(ht->old_lens);
+  drop_trees(ht);
+  if (ht->bloom_bits)
+    bloom_destroy(&ht->bloom);
+  free(ht->front);
+  slab_destroy(&ht->nodes);
+  arena_destroy(&ht->strings);
+  if (ht->snap)
+    munmap(ht->snap, ht->snap_len);
+  free(ht);
+}
+
+/* adds a tombstone to hide the snapshot's entry for key */
+static void bury(hashtable_t *ht, bucket_t **head, const char *key,
+                 unsigned long h, unsigned long len) {
+  bucket_t *c = new_entry(ht, head, h, len);
+  c->val = NULL;
+  c->flags = copy_key(ht, c, key, len) | HT_VAL_ARENA | HT_SHADOW | HT_TOMB;
+  tree_add(ht, head, c);
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long h, len;
+  bucket_t **head, **p = NULL, *c;
+
+  if (ht->old_buckets)
+    migrate_step(ht);
+  h = hash_len(ht, key, &len);
+  head = chain(ht, h);
+  if (ht->trees && tree_root(ht, head))
+    c = find_node(ht, head, key, h, len);
+  else
+    c = *(p = find(head, key, h, len));
+  if (c && (c->flags & HT_SHADOW)) {
+    /* the node must stay to hide the snapshot's entry */
+    if (!(c->flags & HT_TOMB)) {
+      free_val(ht, c);
+      c->val = NULL;
+      c->flags |= HT_VAL_ARENA | HT_TOMB;
+      ht->stats.del_hits++;
+    } else {
+      ht->stats.del_misses++;
+    }
+  } else if (c) {
+    if (ht->lru_off)
+      lru_remove(ht, c);
+    free_entry(ht, unlink_entry(ht, head, p, c));
+    ht->count--;
+    ht->stats.del_hits++;
+    check_load(ht);
+  } else if (shadow_flag(ht, key, h, len)) {
+    bury(ht, head, key, h, len);
+    ht->stats.del_hits++;
+    check_load(ht);
+  } else {
+    ht->stats.del_misses++;
+  }
+  op_end(ht, t0);
+}
+
+static void rebuild_bloom(hashtable_t *ht) {
+  unsigned long i;
+  bucket_t *b;
+
+  if (!ht->bloom_bits)
+    return;
+  bloom_destroy(&ht->bloom);
+  bloom_init(&ht->bloom, ht->size * ht->bloom_bits, ht->bloom_bits);
+  for (i=0; i<ht->size; i++)
+    for (b = ht->buckets[i]; b; b = b->next)
+      bloom_add(&ht->bloom, b->hash);
+}
+
+/* An explicit rehash completes synchronously (callers expect the new
+   layout at once), but relinks the existing nodes by their cached hashes
+   rather than re-putting them, so no key is read. The Bloom filter is
+   rebuilt for the new size from the same hashes. A size of 0 is
+   refused, as there would be no bucket to hash to. */
+static void resize_now(hashtable_t *ht, unsigned long newsize) {
+  drop_trees(ht);
+  migrate_all(ht);
+  ht->old_buckets = ht->buckets;
+  ht->old_lens = ht->lens;
+  ht->old_size = ht->size;
+  ht->migrate_idx = 0;
+  alloc_buckets(ht, newsize);
+  migrate_all(ht);
+  rebuild_bloom(ht);
+}
+
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+  if (newsize == 0)
+    return;
+  resize_now(ht, newsize);
+  ht->min_size = newsize;
+}
+
+/* Purging. Each chain is walked once, its doomed nodes unlinked as they
+   are met, so no key is hashed or looked up again as ht_del would; a
+   tree bin just loses the node, and expired entries go too. A node that
+   shadows the snapshot becomes a tombstone, as do the snapshot's own
+   entries pred picks. A shrink then relinks the rest at once, to the
+   size automatic resizing would choose, but not below min_size. */
+#define PURGE_MIN_LOAD 0.125    /* if the table has no min_load */
+
+struct purge {
+  hashtable_t *ht;
+  int (*pred)(char *, void *, void *);
+  void *ctx;
+  unsigned long removed;
+};
+
+static void purge_chain(hashtable_t *ht, bucket_t **head, struct purge *pg,
+                        unsigned long now) {
+  void **root = tree_root(ht, head);
+  unsigned long n = 0;
+  bucket_t **p = head, *b;
+  int drop;
+
+  while ((b = *p)) {
+    if (b->flags & HT_TOMB) {
+      drop = 0;
+    } else if (now && expired(ht, b, now)) {
+      drop = 1;
+      ht->expirations++;
+    } else if ((drop = pg->pred(bucket_key(b), b->val, pg->ctx))) {
+      pg->removed++;
+    }
+    if (drop && (b->flags & HT_SHADOW)) {
+      free_val(ht, b);
+      b->val = NULL;
+      b->flags |= HT_VAL_ARENA | HT_TOMB;
+      drop = 0;
+    }
+    if (!drop) {
+      p = &b->next;
+      n++;
+      continue;
+    }
+    *p = b->next;
+    if (root)
+      tdelete(b, root, tree_cmp);
+    if (ht->lru_off)
+      lru_remove(ht, b);
+    free_entry(ht, b);
+    ht->count--;
+  }
+  set_len(ht, chain_len(ht, head), n);
+}
+
+static int purge_snap(void *ctx, const char *key, unsigned long len,
+                      unsigned long h, void *val) {
+  struct purge *pg = ctx;
+  if (pg->pred((char *)key, val, pg->ctx)) {
+    bury(pg->ht, chain(pg->ht, h), key, h, len);
+    pg->ht->shadowed++;
+    pg->removed++;
+  }
+  return 1;
+}
+
+unsigned long ht_purge(hashtable_t *ht, int (*pred)(char *, void *, void *),
+                       void *ctx) {
+  unsigned long i, size, now = ht->ttl_used ? now_ns() : 0;
+  double min_load = ht->min_load > 0 ? ht->min_load : PURGE_MIN_LOAD;
+  struct purge pg = { ht, pred, ctx, 0 };
+
+  for (i=0; i<ht->size; i++)
+    if (ht->buckets[i])
+      purge_chain(ht, &ht->buckets[i], &pg, now);
+  for (i=ht->migrate_idx; i<ht->old_size; i++)
+    if (ht->old_buckets[i])
+      purge_chain(ht, &ht->old_buckets[i], &pg, now);
+  if (ht->snap)
+    walk_snap(ht, purge_snap, &pg);
+  if (ht->count < min_load * ht->size && (size = target_size(ht)) < ht->size)
+    resize_now(ht, size);
+  return pg.removed;
+}
+
+/* Parallel rehash. Each worker takes a share of the old buckets and
+   relinks their nodes onto one list per worker, by which share of the
+   new buckets they are bound for; after a barrier, each worker pushes the
+   lists bound for its share onto the new chains, counting their lengths.
+   Every list and every new bucket has a single writer in each phase, so
+   nothing is locked. */
+struct rehash_worker {
+  hashtable_t *ht;
+  bucket_t **old;
+  unsigned long old_size;
+  bucket_t **parts;             /* parts[from * nthreads + to] */
+  unsigned long id, nthreads;
+  pthread_barrier_t *barrier;
+  unsigned long hist[HT_HIST_LEN];      /* of the worker's new chains */
+};
+
+static void *rehash_worker(void *arg) {
+  struct rehash_worker *w = arg;
+  unsigned long n = w->nthreads, size = w->ht->size, i, idx;
+  unsigned long lo = w->old_size * w->id / n, hi = w->old_size * (w->id + 1) / n;
+  bucket_t **mine = w->parts + w->id * n, **buckets = w->ht->buckets;
+  unsigned char *lens = w->ht->lens;
+  bucket_t *b, *next;
+
+  for (i=lo; i<hi; i++) {
+    for (b = w->old[i]; b; b = next) {
+      next = b->next;
+      idx = b->hash % size;
+      b->next = mine[idx * n / size];
+      mine[idx * n / size] = b;
+    }
+  }
+  pthread_barrier_wait(w->barrier);
+  for (i=0; i<n; i++) {
+    for (b = w->parts[i * n + w->id]; b; b = next) {
+      next = b->next;
+      idx = b->hash % size;
+      b->next = buckets[idx];
+      buckets[idx] = b;
+      if (lens[idx] < LEN_SAT)
+        lens[idx]++;
+    }
+  }
+  /* the new buckets idx with idx * n / size == id */
+  memset(w->hist, 0, sizeof(w->hist));
+  for (i = (w->id * size + n - 1) / n; i < ((w->id + 1) * size + n - 1) / n; i++)
+    w->hist[hist_col(lens[i])]++;
+  return NULL;
+}
+
+/* ht_rehash with the relinking split across nthreads threads */
+void ht_rehash_parallel(hashtable_t *ht, unsigned long newsize,
+                        unsigned long nthreads) {
+  struct rehash_worker *w;
+  pthread_barrier_t barrier;
+  pthread_t *tids;
+  bucket_t **parts, **old;
+  unsigned long i, j, old_size;
+
+  if (nthreads <= 1 || newsize < nthreads) {
+    ht_rehash(ht, newsize);
+    return;
+  }
+  drop_trees(ht);
+  migrate_all(ht);
+  old = ht->buckets;
+  old_size = ht->size;
+  free(ht->lens);
+  alloc_buckets(ht, newsize);
+  ht->min_size = newsize;
+
+  parts = calloc(nthreads * nthreads, sizeof(bucket_t *));
+  w = malloc(sizeof(struct rehash_worker) * nthreads);
+  tids = malloc(sizeof(pthread_t) * nthreads);
+  pthread_barrier_init(&barrier, NULL, nthreads);
+  for (i=0; i<nthreads; i++) {
+    w[i].ht = ht;
+    w[i].old = old;
+    w[i].old_size = old_size;
+    w[i].parts = parts;
+    w[i].id = i;
+    w[i].nthreads = nthreads;
+    w[i].barrier = &barrier;
+  }
+  for (i=1; i<nthreads; i++)
+    pthread_create(&tids[i], NULL, rehash_worker, &w[i]);
+  rehash_worker(&w[0]);
+  for (i=1; i<nthreads; i++)
+    pthread_join(tids[i], NULL);
+  memset(ht->stats.hist, 0, sizeof(ht->stats.hist));
+  for (i=0; i<nthreads; i++)
+    for (j=0; j<HT_HIST_LEN; j++)
+      ht->stats.hist[j] += w[i].hist[j];
+  pthread_barrier_destroy(&barrier);
+  free(tids);
+  free(w);
+  free(parts);
+  free(old);
+  rebuild_bloom(ht);
+}
+
+/* Batched lookups and inserts. Keys are taken BATCH at a time: all are
+   hashed, then their bucket slots are prefetched, then the chain heads,
+   then the first node's key bytes, so the cache misses for one key
+   overlap with the work on the others instead of being paid in turn. */
+
+#define BATCH 16
+
+struct batch {
+  unsigned long h[BATCH], len[BATCH];
+  bucket_t **head[BATCH];
+};
+
+static void batch_prefetch(hashtable_t *ht, char **keys, unsigned long n,
+                           struct batch *bt) {
+  unsigned long i;
+  bucket_t *b;
+
+  for (i=0; i<n; i++) {
+    bt->h[i] = hash_len(ht, keys[i], &bt->len[i]);
+    bt->head[i] = chain(ht, bt->h[i]);
+    __builtin_prefetch(bt->head[i]);
+  }
+  for (i=0; i<n; i++) {
+    if ((b = *bt->head[i]))
+      __builtin_prefetch(b);
+  }
+  for (i=0; i<n; i++) {
+    if ((b = *bt->head[i]) && b->hash == bt->h[i]
+        && !(b->flags & HT_KEY_INLINE))
+      __builtin_prefetch(b->key);
+  }
+}
+
+/* migration is stepped for the whole batch before any key is hashed, so
+   the chain heads found while prefetching stay valid for the lookups */
+static void batch_migrate(hashtable_t *ht, unsigned long n) {
+  while (ht->old_buckets && n--)
+    migrate_step(ht);
+}
+
+/* vals[i] = ht_get(ht, keys[i]) for each i < n */
+void ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long i, j, m;
+  struct batch bt;
+  bucket_t *b;
+
+  if (ht->lru_off) {
+    /* every hit reorders the recency list anyway */
+    for (i=0; i<n; i++)
+      vals[i] = ht_get(ht, keys[i]);
+    op_end(ht, t0);
+    return;
+  }
+  batch_migrate(ht, n);
+  for (i=0; i<n; i+=m) {
+    m = n - i < BATCH ? n - i : BATCH;
+    batch_prefetch(ht, keys + i, m, &bt);
+    for (j=0; j<m; j++) {
+      b = find_node(ht, bt.head[j], keys[i + j], bt.h[j], bt.len[j]);
+      vals[i + j] = entry_val(ht, b, keys[i + j], bt.h[j], bt.len[j]);
+      if (vals[i + j])
+        ht->stats.get_hits++;
+      else
+        ht->stats.get_misses++;
+    }
+  }
+  op_end(ht, t0);
+}
+
+/* ht_put(ht, keys[i], vals[i]) for each i < n, in order */
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  unsigned long t0 = op_begin(ht);
+  unsigned long i, j, m;
+  struct batch bt;
+
+  batch_migrate(ht, n);
+  for (i=0; i<n; i+=m) {
+    m = n - i < BATCH ? n - i : BATCH;
+    batch_prefetch(ht, keys + i, m, &bt);
+    for (j=0; j<m; j++) {
+      put_hashed(ht, keys[i + j], vals[i + j], bt.h[j], bt.len[j], ht->ttl_ns);
+    }
+  }
+  op_end(ht, t0);
+}
+
+/* Snapshot layout, all offsets from the start of the file: the header,
+   then a bucket array of offsets of the first entry in each chain (0 for
+   none), then the entries, each 8-byte aligned. The hash function is
+   recorded by its place in ht_hashfns, so a snapshot opens with the hash
+   it was saved with. */
+
+#define SNAP_MAGIC   "htsnap1"
+#define SNAP_NULL    0xffffffffU     /* vlen of a NULL value */
+
+struct ht_snap {
+  char magic[8];
+  unsigned long size;           /* buckets */
+  unsigned long count;
+  unsigned long hashfn;         /* 0 = hash(), else 1 + ht_hashfns index */
+  unsigned long seed;
+  unsigned long len;            /* file size */
+  unsigned long buckets[];
+};
+
+struct snap_entry {
+  unsigned long next;
+  unsigned long hash;
+  unsigned int klen, vlen;
+  char data[];                  /* key, NUL, val, NUL */
+};
+
+static struct snap_entry *snap_at(hashtable_t *ht, unsigned long off) {
+  return (struct snap_entry *)((char *)ht->snap + off);
+}
+
+/* the value saved for key, with *found (if given) set to whether the
+   key is in the snapshot at all */
+static void *snap_get(hashtable_t *ht, const char *key,
+                      unsigned long h, unsigned long len, int *found) {
+  unsigned long off = ht->snap->buckets[h % ht->snap->size];
+  struct snap_entry *e;
+
+  for (; off; off = e->next) {
+    e = snap_at(ht, off);
+    if (e->hash == h && e->klen == len && memcmp(e->data, key, len) == 0) {
+      if (found)
+        *found = 1;
+      return e->vlen == SNAP_NULL ? NULL : e->data + len + 1;
+    }
+  }
+  return NULL;
+}
+
+static int walk_snap(hashtable_t *ht, int (*f)(void *, const char *,
+                     unsigned long, unsigned long, void *), void *ctx) {
+  struct snap_entry *e;
+  unsigned long i, off;
+  void *val;
+
+  for (i=0; i<ht->snap->size; i++) {
+    for (off = ht->snap->buckets[i]; off; off = e->next) {
+      e = snap_at(ht, off);
+      if (ht->shadowed
+          && find_node(ht, chain(ht, e->hash), e->data, e->hash, e->klen))
+        continue;
+      val = e->vlen == SNAP_NULL ? NULL : e->data + e->klen + 1;
+      if (!f(ctx, e->data, e->klen, e->hash, val))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static unsigned long snap_buckets(hashtable_t *ht) {
+  return ht->snap->size;
+}
+
+/* the entries of snapshot bucket idx not superseded by chained ones */
+static void scan_snap(hashtable_t *ht, unsigned long idx,
+                      void (*fn)(char *, void *)) {
+  struct snap_entry *e;
+  unsigned long off;
+
+  for (off = ht->snap->buckets[idx]; off; off = e->next) {
+    e = snap_at(ht, off);
+    if (ht->shadowed
+        && find_node(ht, chain(ht, e->hash), e->data, e->hash, e->klen))
+      continue;
+    fn(e->data, e->vlen == SNAP_NULL ? NULL : e->data + e->klen + 1);
+  }
+}
+
+struct save {
+  FILE *f;
+  unsigned long size, count, off;
+  unsigned long *heads;
+};
+
+static int count_entry(void *ctx, const char *key, unsigned long len,
+                       unsigned long h, void *val) {
+  ((struct save *)ctx)->count++;
+  return 1;
+}
+
+/* appends an entry, linking it at the head of its chain */
+static int save_entry(void *ctx, const char *key, unsigned long len,
+                      unsigned long h, void *val) {
+  static const char pad[8];
+  struct save *sv = ctx;
+  struct snap_entry e;
+  unsigned long vlen = val ? strlen(val) : 0, n;
+
+  e.next = sv->heads[h % sv->size];
+  e.hash = h;
+  e.klen = len;
+  e.vlen = val ? vlen : SNAP_NULL;
+  n = sizeof(e) + len + 1 + (val ? vlen + 1 : 0);
+  if (fwrite(&e, sizeof(e), 1, sv->f) != 1
+      || fwrite(key, 1, len + 1, sv->f) != len + 1
+      || (val && fwrite(val, 1, vlen + 1, sv->f) != vlen + 1)
+      || fwrite(pad, 1, -n & 7, sv->f) != (-n & 7))
+    return 0;
+  sv->heads[h % sv->size] = sv->off;
+  sv->off += (n + 7) & ~7UL;
+  return 1;
+}
+
+/* The file is written beside path and renamed over it once complete, so
+   a crash never leaves a partial snapshot under the real name. */
+int ht_save(hashtable_t *ht, const char *path) {
+  struct ht_snap hdr;
+  struct save sv;
+  char *tmp;
+  unsigned long i;
+  int ok;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+  if (ht->hashfn) {
+    for (i=0; ht_hashfns[i].name && ht_hashfns[i].fn != ht->hashfn; i++)
+      ;
+    if (!ht_hashfns[i].name) {
+      errno = EINVAL;           /* a hash function we could not reopen */
+      return -1;
+    }
+    hdr.hashfn = i + 1;
+  }
+  hdr.seed = ht->seed;
+
+  memset(&sv, 0, sizeof(sv));
+  walk(ht, count_entry, &sv);
+  for (sv.size = 1; sv.size < sv.count; sv.size <<= 1)
+    ;
+  hdr.size = sv.size;
+  hdr.count = sv.count;
+  sv.off = sizeof(hdr) + sizeof(unsigned long) * sv.size;
+
+  tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  if (!(sv.f = fopen(tmp, "w"))) {
+    free(tmp);
+    return -1;
+  }
+  sv.heads = calloc(sv.size, sizeof(unsigned long));
+  ok = fseek(sv.f, sv.off, SEEK_SET) == 0 && walk(ht, save_entry, &sv);
+  hdr.len = sv.off;
+  ok = ok && fseek(sv.f, 0, SEEK_SET) == 0
+    && fwrite(&hdr, sizeof(hdr), 1, sv.f) == 1
+    && fwrite(sv.heads, sizeof(unsigned long), sv.size, sv.f) == sv.size
+    && fflush(sv.f) == 0 && fsync(fileno(sv.f)) == 0;
+  ok = fclose(sv.f) == 0 && ok && rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  free(sv.heads);
+  free(tmp);
+  return ok ? 0 : -1;
+}
+
+/* Nothing in the file is read here beyond its header; entries are paged
+   in by the lookups that reach them. */
+hashtable_t *ht_open_mapped(const char *path) {
+  ht_config_t cfg = { 1.0, 0, NULL };
+  struct ht_snap *s;
+  struct stat st;
+  hashtable_t *ht;
+  unsigned long nfns;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if ((unsigned long)st.st_size < sizeof(struct ht_snap)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  s = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (s == MAP_FAILED)
+    return NULL;
+  for (nfns = 0; ht_hashfns[nfns].name; nfns++)
+    ;
+  if (memcmp(s->magic, SNAP_MAGIC, sizeof(s->magic)) != 0
+      || s->len != (unsigned long)st.st_size || s->size == 0 || s->hashfn > nfns
+      || s->size > (s->len - sizeof(*s)) / sizeof(unsigned long)) {
+    munmap(s, st.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+  /* the chains start small and grow with the changes they hold */
+  cfg.hashfn = s->hashfn ? ht_hashfns[s->hashfn - 1].fn : hash_djb;
+  ht = make_hashtable_cfg(64, &cfg);
+  ht->seed = s->seed;
+  ht->snap = s;
+  ht->snap_len = st.st_size;
+  return ht;
+}
+
+/* Frozen tables. Keys are hashed once with hash_wy; the top half of the
+   hash picks one of count / FROZEN_LAMBDA buckets, and the bucket's
+   displacement d picks the slot, by a second mix of the hash with d.
+   Buckets are placed largest first, each taking the first d that sends
+   all its keys to free slots (CHD, Belazzougui et al.), so every key
+   gets a slot of its own and a lookup reads one displacement, one slot
+   and one key. A bucket of one key, placed last, into a nearly full
+   array, would take the longest to find a d for; it is given its slot
+   directly instead, flagged FROZEN_DIRECT. */
+
+#define FROZEN_LAMBDA 4         /* keys per bucket, on average */
+#define FROZEN_DIRECT 0x80000000U
+#define FROZEN_MAX_D  (1U << 24)
+#define FROZEN_TRIES  8         /* seeds tried before giving up */
+
+static unsigned long frozen_mix(unsigned long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline unsigned long frozen_bucket(unsigned long h, unsigned long nb) {
+  return (h >> 32) * nb >> 32;
+}
+
+static inline unsigned long frozen_slot(unsigned long h, unsigned long d,
+                                        unsigned long n) {
+  if (d & FROZEN_DIRECT)
+    return d & ~FROZEN_DIRECT;
+  return (frozen_mix(h ^ d * 0x9e3779b97f4a7c15UL) & 0xffffffffUL) * n >> 32;
+}
+
+struct freeze {
+  unsigned long n, bytes;
+  const char **keys;
+  unsigned long *lens;
+  void **vals;
+  bucket_t **nodes;             /* NULL for a snapshot entry */
+  int *copy;                    /* val is a string to copy in */
+};
+
+static void freeze_add(struct freeze *fz, const char *key, unsigned long len,
+                       void *val, bucket_t *b, int copy) {
+  fz->keys[fz->n] = key;
+  fz->lens[fz->n] = len;
+  fz->vals[fz->n] = val;
+  fz->nodes[fz->n] = b;
+  fz->copy[fz->n] = copy && val;
+  fz->bytes += len + 1 + (copy && val ? strlen(val) + 1 : 0);
+  fz->n++;
+}
+
+static int freeze_snap_entry(void *ctx, const char *key, unsigned long len,
+                             unsigned long h, void *val) {
+  freeze_add(ctx, key, len, val, NULL, 1);
+  return 1;
+}
+
+static void freeze_chains(hashtable_t *ht, struct freeze *fz,
+                          bucket_t **buckets, unsigned long lo,
+                          unsigned long size, unsigned long now) {
+  unsigned long i;
+  bucket_t *b;
+  for (i=lo; i<size; i++)
+    for (b = buckets[i]; b; b = b->next)
+      if (live(ht, b, now))
+        freeze_add(fz, bucket_key(b), b->klen, b->val, b,
+                   (b->flags & HT_VAL_ARENA) != 0);
+}
+
+/* disp[] for keys hashing to h[0..n), placing key i in slot[.] = i;
+   0 if some bucket found no displacement */
+static int frozen_place(unsigned long *h, unsigned long n, unsigned long nb,
+                        unsigned int *disp, unsigned long *slot) {
+  unsigned long *start = calloc(nb + 1, sizeof(unsigned long));
+  unsigned long *members = malloc(sizeof(unsigned long) * n);
+  unsigned long *order = malloc(sizeof(unsigned long) * nb);
+  unsigned long *bysize, i, j, k, b, s, max = 0, pos[64];
+  unsigned char *taken = calloc(n, 1);
+  unsigned long next_free = 0;
+  int ok = 1;
+  unsigned int d;
+
+  for (i=0; i<n; i++)
+    start[frozen_bucket(h[i], nb) + 1]++;
+  for (b=0; b<nb; b++) {
+    if (start[b + 1] > max)
+      max = start[b + 1];
+    start[b + 1] += start[b];
+  }
+  for (i=0; i<n; i++) {
+    b = frozen_bucket(h[i], nb);
+    members[start[b]++] = i;
+  }
+  for (b=nb; b>0; b--)          /* undo the fill */
+    start[b] = start[b - 1];
+  start[0] = 0;
+
+  /* buckets by size, largest first */
+  bysize = calloc(max + 2, sizeof(unsigned long));
+  for (b=0; b<nb; b++)
+    bysize[max - (start[b + 1] - start[b]) + 1]++;
+  for (s=0; s<=max; s++)
+    bysize[s + 1] += bysize[s];
+  for (b=0; b<nb; b++)
+    order[bysize[max - (start[b + 1] - start[b])]++] = b;
+
+  memset(disp, 0, sizeof(unsigned int) * nb);
+  for (i=0; i<nb && ok; i++) {
+    b = order[i];
+    s = start[b + 1] - start[b];
+    if (s == 0)
+      break;
+    if (s > sizeof(pos) / sizeof(pos[0])) {
+      ok = 0;
+      break;
+    }
+    if (s == 1) {
+      while (taken[next_free])
+        next_free++;
+      disp[b] = FROZEN_DIRECT | next_free;
+      taken[next_free] = 1;
+      slot[next_free] = members[start[b]];
+      continue;
+    }
+    for (d=0; d<FROZEN_MAX_D; d++) {
+      for (j=0; j<s; j++) {
+        pos[j] = frozen_slot(h[members[start[b] + j]], d, n);
+        if (taken[pos[j]])
+          break;
+        for (k=0; k<j && pos[k] != pos[j]; k++)
+          ;
+        if (k < j)
+          break;
+      }
+      if (j == s)
+        break;
+    }
+    if (d == FROZEN_MAX_D) {
+      ok = 0;
+      break;
+    }
+    disp[b] = d;
+    for (j=0; j<s; j++) {
+      taken[pos[j]] = 1;
+      slot[pos[j]] = members[start[b] + j];
+    }
+  }
+  free(start);
+  free(members);
+  free(order);
+  free(bysize);
+  free(taken);
+  return ok;
+}
+
+/* Freezes ht's live entries into a read-only table and frees ht, which
+   hands over the values it would have free()d; values it holds as
+   strings (from ht_put_str or a snapshot) are copied in. Returns NULL
+   with errno set, and ht untouched, if no perfect hash was found, or
+   there are 2^31 keys or 4GB of keys and strings. */
+ht_frozen_t *ht_freeze(hashtable_t *ht) {
+  unsigned long now = ht->ttl_used ? now_ns() : 0, i, j, n, off, tries;
+  unsigned long max = ht->count + (ht->snap ? ht->snap->count : 0);
+  unsigned long *h, *slot;
+  struct freeze fz = { 0 };
+  ht_frozen_t *f = calloc(1, sizeof(ht_frozen_t));
+  char *p;
+
+  fz.keys = malloc(sizeof(char *) * max);
+  fz.lens = malloc(sizeof(unsigned long) * max);
+  fz.vals = malloc(sizeof(void *) * max);
+  fz.nodes = malloc(sizeof(bucket_t *) * max);
+  fz.copy = malloc(sizeof(int) * max);
+  freeze_chains(ht, &fz, ht->buckets, 0, ht->size, now);
+  if (ht->old_buckets)
+    freeze_chains(ht, &fz, ht->old_buckets, ht->migrate_idx, ht->old_size,
+                  now);
+  if (ht->snap)
+    walk_snap(ht, freeze_snap_entry, &fz);
+  n = f->count = fz.n;
+  if (fz.bytes > 0xffffffffUL || n >= FROZEN_DIRECT) {
+    free(f);
+    f = NULL;
+    errno = EFBIG;
+    goto out;
+  }
+  f->nbuckets = n / FROZEN_LAMBDA + 1;
+  f->disp = malloc(sizeof(unsigned int) * f->nbuckets);
+  f->slots = malloc(sizeof(struct ht_frozen_slot) * (n ? n : 1));
+  h = malloc(sizeof(unsigned long) * (n ? n : 1));
+  slot = malloc(sizeof(unsigned long) * (n ? n : 1));
+  for (tries=0; tries<FROZEN_TRIES; tries++) {
+    f->seed = hash_random_seed();
+    for (i=0; i<n; i++)
+      h[i] = hash_wy(fz.keys[i], fz.lens[i], f->seed);
+    if (frozen_place(h, n, f->nbuckets, f->disp, slot))
+      break;
+  }
+  free(h);
+  if (tries == FROZEN_TRIES) {
+    free(slot);
+    ht_frozen_free(f);
+    f = NULL;
+    errno = EAGAIN;
+    goto out;
+  }
+
+  f->bytes = fz.bytes;
+  p = f->strings = malloc(fz.bytes ? fz.bytes : 1);
+  for (j=0; j<n; j++) {
+    i = slot[j];
+    off = p - f->strings;
+    memcpy(p, fz.keys[i], fz.lens[i]);
+    p[fz.lens[i]] = '\0';
+    p += fz.lens[i] + 1;
+    f->slots[j].key = off;
+    f->slots[j].klen = fz.lens[i];
+    if (fz.copy[i]) {
+      f->slots[j].val = strcpy(p, fz.vals[i]);
+      p += strlen(p) + 1;
+    } else {
+      f->slots[j].val = fz.vals[i];
+    }
+  }
+  free(slot);
+  /* the frozen table owns the values now */
+  for (i=0; i<n; i++) {
+    if (fz.nodes[i] && !fz.copy[i] && !(fz.nodes[i]->flags & HT_VAL_ARENA)) {
+      fz.nodes[i]->flags |= HT_VAL_ARENA;
+      ht->heap_fields--;
+    }
+  }
+  free_hashtable(ht);
+out:
+  free(fz.keys);
+  free(fz.lens);
+  free(fz.vals);
+  free(fz.nodes);
+  free(fz.copy);
+  return f;
+}
+
+void *ht_frozen_get(ht_frozen_t *f, const char *key) {
+  unsigned long len = strlen(key), h, i;
+  struct ht_frozen_slot *s;
+
+  if (!f->count)
+    return NULL;
+  h = hash_wy(key, len, f->seed);
+  i = frozen_slot(h, f->disp[frozen_bucket(h, f->nbuckets)], f->count);
+  s = &f->slots[i];
+  if (s->klen == len && memcmp(f->strings + s->key, key, len) == 0)
+    return s->val;
+  return NULL;
+}
+
+unsigned long ht_frozen_bytes(ht_frozen_t *f) {
+  return sizeof(ht_frozen_t) + f->nbuckets * sizeof(unsigned int)
+    + f->count * sizeof(struct ht_frozen_slot) + f->bytes;
+}
+
+void ht_frozen_free(ht_frozen_t *f) {
+  unsigned long i;
+  for (i=0; i<f->count && f->strings; i++) {
+    if (!(f->slots[i].val >= (void *)f->strings
+          && f->slots[i].val < (void *)(f->strings + f->bytes)))
+      free(f->slots[i].val);
+  }
+  free(f->disp);
+  free(f->slots);
+  free(f->strings);
+  free(f);
 }
@@ -1,28 +1,319 @@
 #ifndef HASHTABLE_T
 #define HASHTABLE_T
 
+#include "bloom.h"
+#include "hashfn.h"
+#include "slab.h"
+
 typedef struct hashtable hashtable_t;
-typedef struct bucket bucket_t;
+typedef struct ht_config ht_config_t;
 
-struct bucket {
+/* Optional settings for make_hashtable_cfg; a zeroed config (or NULL)
+   gives the same table as make_hashtable. */
+struct ht_config {
+  double max_load;      /* grow past this load factor; 0 = never resize */
+  double min_load;      /* shrink below this load factor */
+  /* see hashfn.h; NULL = hash_sip, keyed by the seed, so that keys
+     which collide cannot be found from outside; hash_djb gives hash()
+     itself, unseeded, and the same layout on every run */
+  ht_hashfn_t hashfn;
+  unsigned long seed;   /* for hashfn; 0 = a random seed for each table */
+  int no_inline;        /* keep every key out of line, in smaller nodes */
+  int tree_bins;        /* index chains that grow past HT_TREE_MIN */
+  /* cache mode, if either is set; see ht_put_ttl */
+  unsigned long capacity;   /* evict least recently used past this count */
+  unsigned long ttl_ms;     /* lifetime of entries put without a TTL */
+  /* a counting Bloom filter of this many counters per bucket, tested
+     before any chain is walked; 0 = none */
+  unsigned long bloom_bits;
+  /* a 2-way cache of about this many recently read entries, checked by
+     ht_get before the key is hashed; 0 = none (and none in cache mode) */
+  unsigned long front_slots;
+};
+
+/* Statistics, kept up to date by every change so that ht_stats costs the
+   same on any size of table. On the chained backend hist[n] is the
+   number of buckets whose chain has n nodes (tombstones included); on
+   the others it is the number of entries reached by a probe of length n,
+   as ht_probe_len counts it. Lengths of HT_HIST_LEN - 1 and up share the
+   last column. */
+#define HT_HIST_LEN 32
+
+typedef struct ht_stats {
+  unsigned long count;          /* entries */
+  unsigned long size;           /* buckets (both arrays while migrating),
+                                   or slots */
+  double load;                  /* count / size */
+  unsigned long hist[HT_HIST_LEN];
+  unsigned long total_len;      /* sum of the lengths hist counts */
+  unsigned long max_len;        /* longest; HT_HIST_LEN - 1 = that or more */
+  unsigned long bytes;          /* held by the table, less keys and values
+                                   it was handed by ht_put */
+  unsigned long get_hits, get_misses;
+  unsigned long put_hits, put_misses;   /* by whether the key was there */
+  unsigned long del_hits, del_misses;
+  unsigned long front_hits, front_misses;   /* gets, if there is a front
+                                               cache (chained only) */
+} ht_stats_t;
+
+#ifdef HT_OPEN_ADDRESSING
+
+/* Open-addressed backend (hashtable-oa.c). Slots are probed a group of
+   HT_GROUP at a time; ctrl[i] is HT_EMPTY, HT_DELETED, or the top 7 bits
+   of the hash of the key stored in slots[i]. */
+#define HT_GROUP   16
+#define HT_EMPTY   0x80
+#define HT_DELETED 0xfe
+
+typedef struct slot slot_t;
+
+struct slot {
   char *key;
   void *val;
+  unsigned long hash;
+};
+
+struct hashtable {
+  unsigned long size;           /* slots, HT_GROUP times a power of 2 */
+  unsigned long count;
+  unsigned long deleted;
+  unsigned long allocs;         /* mallocs made by the table */
+  ht_hashfn_t hashfn;
+  unsigned long seed;
+  unsigned char *ctrl;
+  slot_t *slots;
+  ht_stats_t stats;             /* the counters; see ht_stats */
+};
+
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long idx);
+
+#elif defined(HT_COMPACT)
+
+/* Compact backend (hashtable-compact.c): entries in insertion order in
+   one dense array, with deleted ones left as holes (key NULL) until the
+   next resize; index[] holds entry numbers, HT_IX_EMPTY or HT_IX_DUMMY
+   (deleted), in 1, 2 or 4 bytes each by the index size. */
+#define HT_IX_EMPTY (-1)
+#define HT_IX_DUMMY (-2)
+
+typedef struct entry entry_t;
+
+struct entry {
+  unsigned long hash;
+  char *key;
+  void *val;
+};
+
+struct hashtable {
+  unsigned long size;           /* index slots, a power of two */
+  unsigned long count;
+  unsigned long nentries;       /* entries used, holes included */
+  unsigned long usable;         /* entries allocated, 2/3 of size */
+  unsigned long scan_cursor;    /* the last cursor ht_scan returned, */
+  unsigned long scan_pos;       /* and where its entry is now */
+  int ix_width;
+  void *index;
+  entry_t *entries;
+  unsigned long allocs;         /* mallocs made by the table */
+  ht_hashfn_t hashfn;
+  unsigned long seed;
+  ht_stats_t stats;             /* the counters; see ht_stats */
+};
+
+/* index slots examined to reach entry ix */
+unsigned long ht_probe_len(hashtable_t *ht, unsigned long ix);
+
+#else
+
+#define HT_CHAINED
+
+typedef struct bucket bucket_t;
+
+/* bucket flags: key/val was copied into the table's string arena by
+   ht_put_str, rather than malloc'd by the caller; the key is short enough
+   to be held in the node itself (HT_KEY_INLINE); on a table opened with
+   ht_open_mapped, the key is also in the snapshot (HT_SHADOW), and has
+   been deleted since (HT_TOMB) */
+#define HT_KEY_ARENA 0x1
+#define HT_VAL_ARENA 0x2
+#define HT_SHADOW    0x4
+#define HT_TOMB      0x8
+#define HT_KEY_INLINE 0x10
+
+#define HT_INLINE_MAX 23        /* longest key kept in ikey */
+
+/* With tree_bins set, a chain found to be longer than this is also
+   indexed by a balanced tree (see tsearch(3)) ordered on hash, length and
+   key, so lookups stay O(log n) even if every key has the same hash. */
+#define HT_TREE_MIN   8
+
+/* key comes last so that a table with no_inline set can allocate nodes
+   that stop short of ikey */
+struct bucket {
   bucket_t *next;
+  unsigned long hash;           /* full hash of key */
+  unsigned int klen;            /* strlen(key) */
+  unsigned int flags;
+  void *val;
+  union {
+    char *key;
+    char ikey[HT_INLINE_MAX + 1];
+  };
 };
 
 struct hashtable {
   unsigned long size;
   bucket_t **buckets;
+  unsigned long count;
+  ht_hashfn_t hashfn;           /* NULL = hash(), with hash_len */
+  unsigned long seed;           /* from the config, or random */
+  void **trees;                 /* tree roots by bucket, if any; see above */
+  int tree_bins;
+  /* automatic resizing: while old_buckets is set, old buckets from
+     migrate_idx on have not been moved to buckets yet */
+  double max_load, min_load;
+  unsigned long min_size;
+  bucket_t **old_buckets;
+  unsigned long old_size;
+  unsigned long migrate_idx;
+  unsigned long resizes;
+  unsigned long max_migrate_op_ns;  /* slowest op while migrating */
+  /* memory: nodes come from a slab pool, ht_put_str copies into an arena,
+     and heap_fields counts keys and values the table must free() */
+  slab_pool_t nodes;
+  arena_t strings;
+  unsigned long heap_fields;
+  unsigned long allocs;         /* mallocs made outside nodes and strings */
+  int inline_keys;              /* short keys go in the node (HT_KEY_INLINE) */
+  /* cache mode: every node also has a struct lru at lru_off (0 if not a
+     cache), linking it into a list in order of use, most recent first */
+  unsigned long lru_off;
+  bucket_t *lru_head, *lru_tail;
+  unsigned long capacity;
+  unsigned long ttl_ns;         /* default lifetime */
+  int ttl_used;                 /* some entry has a deadline */
+  unsigned long sweep_idx;      /* next bucket for ht_expire */
+  unsigned long evictions, expirations;
+  /* every key in the chains is in the filter, if bloom_bits is set; it is
+     sized again by ht_rehash, but not by automatic resizing */
+  bloom_t bloom;
+  unsigned long bloom_bits;
+  /* front cache, if front_slots was set: front_mask + 1 sets of nodes
+     recently found by ht_get */
+  struct ht_front *front;
+  unsigned long front_mask;
+  /* ht_open_mapped: the snapshot's entries stay in the mapped file, and
+     the chains above hold only changes made since it was opened, which
+     count and the stats cover */
+  struct ht_snap *snap;
+  unsigned long snap_len;
+  unsigned long shadowed;       /* chained entries flagged HT_SHADOW */
+  /* chain lengths by bucket, saturating at 255, for the histogram in
+     stats; old_lens goes with old_buckets */
+  unsigned char *lens, *old_lens;
+  ht_stats_t stats;             /* the counters; see ht_stats */
+};
+
+/* Snapshots. ht_save writes the table's entries to path, with values
+   taken to be strings (or NULL), in a layout of file offsets rather than
+   pointers. ht_open_mapped maps such a file read-only and looks keys up
+   in it in place; puts and deletes go to an ordinary table in front of
+   the mapping, so the file itself is never written. Both return -1/NULL
+   with errno set on failure. Only the chained backend has snapshots. */
+int          ht_save(hashtable_t *ht, const char *path);
+hashtable_t *ht_open_mapped(const char *path);
+
+/* Frozen tables. ht_freeze replaces a table whose keys will not change
+   with a minimal perfect hash over them: each key has a slot of its own
+   in one array, found with no probing, keys packed after it. Values are
+   taken over as they are; ht_frozen_free frees them unless they were
+   strings the table kept itself. */
+typedef struct ht_frozen ht_frozen_t;
+
+struct ht_frozen {
+  unsigned long count;          /* keys, and slots */
+  unsigned long nbuckets;
+  unsigned long seed;           /* for hash_wy */
+  unsigned int *disp;           /* displacement by bucket */
+  struct ht_frozen_slot {
+    unsigned int key, klen;     /* key is an offset into strings */
+    void *val;
+  } *slots;
+  char *strings;                /* keys, and values that were copied */
+  unsigned long bytes;
 };
 
+ht_frozen_t  *ht_freeze(hashtable_t *ht);
+void         *ht_frozen_get(ht_frozen_t *f, const char *key);
+unsigned long ht_frozen_bytes(ht_frozen_t *f);
+void          ht_frozen_free(ht_frozen_t *f);
+
+#endif
+
 unsigned long hash(char *str);
 
 hashtable_t *make_hashtable(unsigned long size);
+hashtable_t *make_hashtable_cfg(unsigned long size, const ht_config_t *cfg);
 void  ht_put(hashtable_t *ht, char *key, void *val);
+void  ht_put_str(hashtable_t *ht, const char *key, const char *val);
 void *ht_get(hashtable_t *ht, char *key);
 void  ht_del(hashtable_t *ht, char *key);
 void  ht_iter(hashtable_t *ht, int (*f)(char *, void *));
+void  ht_get_many(hashtable_t *ht, char **keys, unsigned long n, void **vals);
+void  ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n);
 void  ht_rehash(hashtable_t *ht, unsigned long newsize);
+void  ht_rehash_parallel(hashtable_t *ht, unsigned long newsize,
+                         unsigned long nthreads);
 void  free_hashtable(hashtable_t *ht);
 
+/* copies out the counters kept in the table; costs nothing to speak of,
+   whatever its size */
+void  ht_stats(hashtable_t *ht, ht_stats_t *out);
+
+/* Find or create key's entry and return its value slot, NULL for a new
+   key, to be updated in place; ht_upsert passes the slot to fn. The key
+   is copied. The slot is valid until the next call that changes the
+   table, and its value is free()d by the table like one from ht_put. */
+void **ht_get_or_insert(hashtable_t *ht, const char *key);
+
+/* Incremental iteration: ht_scan(ht, 0, ...) starts a scan, each call
+   visits count more buckets, calling fn on their entries, and returns the
+   cursor for the next call, 0 once the scan is done. fn must not change
+   the table, but the caller may between calls: an entry there for the
+   whole scan is seen at least once, and may be seen more than once if
+   the table was resized meanwhile. On the chained backend that holds
+   across resizes between power-of-two sizes, which are the only ones
+   automatic resizing makes; open addressing has no others. The compact
+   backend keeps it for the most recent scan only: a resize renumbers
+   the entries, and the table moves only the last cursor it returned. */
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor,
+                      unsigned long count, void (*fn)(char *, void *));
+void  ht_upsert(hashtable_t *ht, const char *key,
+                void (*fn)(void **val, void *ctx), void *ctx);
+
+/* Removes every entry for which pred(key, val, ctx) returns nonzero, in
+   one pass over the table, and returns how many went. If that leaves the
+   table below its minimum load (1/8 if it has none), the table is shrunk
+   before returning. pred must not change the table. */
+unsigned long ht_purge(hashtable_t *ht, int (*pred)(char *, void *, void *),
+                       void *ctx);
+
+/* Cache mode. Gets and puts move an entry to the front of the recency
+   list, and a put that takes the table past its capacity evicts from the
+   back. An entry past its deadline is dropped by the ht_get that finds
+   it, or by ht_expire, which puts also call for a few buckets at a time;
+   until then ht_del and ht_put still see it. ht_put_ttl is ht_put with a
+   lifetime (0 = forever) in place of the table's default; TTLs and the
+   counters are only kept in cache mode, and only by the chained
+   backend. */
+typedef struct ht_cache_stats {
+  unsigned long hits, misses;   /* ht_get calls, as in ht_stats */
+  unsigned long evictions, expirations;
+  unsigned long count, capacity;
+} ht_cache_stats_t;
+
+void  ht_put_ttl(hashtable_t *ht, char *key, void *val, unsigned long ttl_ms);
+unsigned long ht_expire(hashtable_t *ht, unsigned long nbuckets);
+void  ht_cache_stats(hashtable_t *ht, ht_cache_stats_t *out);
+
 #endif
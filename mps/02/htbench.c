@@ -0,0 +1,1394 @@
+#include <fcntl.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hashtable.h"
+#include "htgen.h"
+#include "trace.h"
+#include "wal.h"
+
+/* Benchmarks for the hashtable library; see usage() for the modes. */
+
+#define HIST_MAX 8      /* chain lengths >= this share the last column */
+
+static unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* bytes in use on the heap, counting large blocks malloc mmaps itself */
+static size_t heap_bytes(void) {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+/* keys collected by collect_key from a table of unique trace keys */
+static char **keys;
+static unsigned long nkeys;
+
+static int collect_key(char *key, void *val) {
+  keys[nkeys++] = key;
+  return 1;
+}
+
+/* reads the key of every p/g/d directive in the given traces, returning
+   a table holding each distinct key once and filling in keys/nkeys */
+static hashtable_t *load_trace_keys(int nfiles, char **files) {
+  hashtable_t *ht = make_hashtable(1024);
+  char *line = NULL, *tok;
+  size_t cap = 0;
+  FILE *f;
+  int i;
+
+  for (i=0; i<nfiles; i++) {
+    if (!(f = fopen(files[i], "r"))) {
+      printf("Error opening tracefile %s\n", files[i]);
+      exit(1);
+    }
+    getline(&line, &cap, f); /* table size */
+    while (getline(&line, &cap, f) != -1) {
+      tok = strtok(line, " \t\n");
+      if (tok && strchr("pgd", tok[0]) && (tok = strtok(NULL, " \t\n"))) {
+        ht_put(ht, strdup(tok), NULL);
+      }
+    }
+    fclose(f);
+  }
+  free(line);
+  ht_rehash(ht, ht->count);
+  keys = malloc(sizeof(char *) * ht->count);
+  nkeys = 0;
+  ht_iter(ht, collect_key);
+  return ht;
+}
+
+/* mean ns per call of fn over the given keys, repeated for at least
+   100ms of wall time */
+static double time_hash(ht_hashfn_t fn, char **ks, unsigned long *lens,
+                        unsigned long n) {
+  unsigned long t0 = now_ns(), t, rounds = 0, i;
+  volatile unsigned long sink = 0;
+
+  do {
+    for (i=0; i<n; i++) {
+      sink += fn(ks[i], lens[i], 0);
+    }
+    rounds++;
+    t = now_ns() - t0;
+  } while (t < 100000000UL);
+  return (double)t / (rounds * n);
+}
+
+/* distribution of chain lengths if every key were put in a table of
+   the given size */
+static void print_histogram(ht_hashfn_t fn, unsigned long *lens,
+                            unsigned long size) {
+  unsigned long *chain = calloc(size, sizeof(unsigned long));
+  unsigned long hist[HIST_MAX + 1] = { 0 }, i, max = 0, len;
+
+  for (i=0; i<nkeys; i++) {
+    chain[fn(keys[i], lens[i], 0) % size]++;
+  }
+  for (i=0; i<size; i++) {
+    len = chain[i];
+    if (len > max) {
+      max = len;
+    }
+    hist[len < HIST_MAX ? len : HIST_MAX]++;
+  }
+  printf("%8lu %4lu ", size, max);
+  for (i=0; i<=HIST_MAX; i++) {
+    printf(" %5.1f", 100.0 * hist[i] / size);
+  }
+  printf("\n");
+  free(chain);
+}
+
+static int bench_hash(int argc, char **argv) {
+  const ht_hashfn_info_t *h;
+  hashtable_t *ht;
+  unsigned long *lens, i, j, pow2 = 1, nlong = 256, longlen = 256;
+  unsigned long *longlens, sizes[2];
+  char **longkeys;
+
+  if (argc < 1) {
+    return -1;
+  }
+  ht = load_trace_keys(argc, argv);
+  lens = malloc(sizeof(unsigned long) * nkeys);
+  for (i=0; i<nkeys; i++) {
+    lens[i] = strlen(keys[i]);
+  }
+  longkeys = malloc(sizeof(char *) * nlong);
+  longlens = malloc(sizeof(unsigned long) * nlong);
+  srandom(351);
+  for (i=0; i<nlong; i++) {
+    longkeys[i] = malloc(longlen + 1);
+    for (j=0; j<longlen; j++) {
+      longkeys[i][j] = 'a' + random() % 26;
+    }
+    longkeys[i][longlen] = '\0';
+    longlens[i] = longlen;
+  }
+  while (pow2 < nkeys) {
+    pow2 <<= 1;
+  }
+  /* load 1 at the trace's own kind of size, and at the power of two
+     automatic resizing would pick, where only the low bits matter */
+  sizes[0] = nkeys;
+  sizes[1] = pow2;
+
+  printf("%lu distinct keys from %d trace file(s)\n\n", nkeys, argc);
+  printf("%-8s %12s %14s\n", "hash", "ns/hash", "ns/hash(256B)");
+  for (h = ht_hashfns; h->name; h++) {
+    printf("%-8s %12.2f %14.2f\n", h->name,
+           time_hash(h->fn, keys, lens, nkeys),
+           time_hash(h->fn, longkeys, longlens, nlong));
+  }
+  printf("\nChain lengths, %% of buckets (Poisson(1) is about"
+         " 36.8 36.8 18.4 6.1 1.5 0.3 ...)\n");
+  printf("%-8s %8s %4s ", "hash", "size", "max");
+  for (i=0; i<=HIST_MAX; i++) {
+    printf(" %4lu%s", i, i == HIST_MAX ? "+" : " ");
+  }
+  printf("\n");
+  for (h = ht_hashfns; h->name; h++) {
+    for (i=0; i<2; i++) {
+      printf("%-8s ", i == 0 ? h->name : "");
+      print_histogram(h->fn, lens, sizes[i]);
+    }
+  }
+
+  for (i=0; i<nlong; i++) {
+    free(longkeys[i]);
+  }
+  free(longkeys);
+  free(longlens);
+  free(lens);
+  free(keys);
+  free_hashtable(ht);
+  return 0;
+}
+
+/* n keys "k<i>" with i drawn from a fixed random permutation, packed
+   into one buffer; order[] then lists them in a second random order for
+   the lookups, so consecutive lookups share no cache lines */
+static char **make_keys(unsigned long n, char **buf) {
+  char **ks = malloc(sizeof(char *) * n), *p;
+  unsigned long i;
+
+  p = *buf = malloc(n * 24);
+  for (i=0; i<n; i++) {
+    ks[i] = p;
+    p += sprintf(p, "k%lu", (i * 2654435761UL) % (n * 4)) + 1;
+  }
+  return ks;
+}
+
+static void shuffle(char **ks, unsigned long n) {
+  unsigned long i, j;
+  char *t;
+  for (i=n-1; i>0; i--) {
+    j = random() % (i + 1);
+    t = ks[i];
+    ks[i] = ks[j];
+    ks[j] = t;
+  }
+}
+
+static int bench_batch(int argc, char **argv) {
+  unsigned long sizes[] = { 1UL << 12, 1UL << 16, 1UL << 20, 1UL << 22, 0 };
+  unsigned long batches[] = { 4, 16, 64, 256 };
+  unsigned long max = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 22;
+  unsigned long n, i, j, b, t, lookups, found;
+  char **ks, *buf;
+  void **vals;
+  hashtable_t *ht;
+  int s;
+
+  srandom(351);
+  printf("%10s %10s %10s", "entries", "table MB", "ht_get");
+  for (b=0; b<sizeof(batches)/sizeof(batches[0]); b++) {
+    printf("   many/%-4lu", batches[b]);
+  }
+  printf("   (ns per lookup)\n");
+  for (s=0; sizes[s] && sizes[s] <= max; s++) {
+    n = sizes[s];
+    ks = make_keys(n, &buf);
+    ht = make_hashtable(n);
+    for (i=0; i<n; i++) {
+      ht_put_str(ht, ks[i], "v");
+    }
+    shuffle(ks, n);
+    vals = malloc(sizeof(void *) * n);
+    lookups = n < 1000000 ? 1000000 : n;
+    printf("%10lu %10.1f", n, (ht->nodes.nslabs * 64.0 + ht->strings.nchunks * 64.0
+                              + n * sizeof(bucket_t *) / 1024.0) / 1024);
+
+    found = 0;
+    t = now_ns();
+    for (i=0; i<lookups; i++) {
+      found += ht_get(ht, ks[i % n]) != NULL;
+    }
+    printf(" %10.1f", (double)(now_ns() - t) / lookups);
+
+    for (b=0; b<sizeof(batches)/sizeof(batches[0]); b++) {
+      t = now_ns();
+      for (i=0; i<lookups; i+=batches[b]) {
+        j = i % n;
+        ht_get_many(ht, ks + j, n - j < batches[b] ? n - j : batches[b], vals);
+        found += vals[0] != NULL;
+      }
+      printf("   %9.1f", (double)(now_ns() - t) / lookups);
+    }
+    printf("\n");
+    if (found == 0) {
+      printf("no keys found?\n");
+    }
+    free(vals);
+    free_hashtable(ht);
+    free(ks);
+    free(buf);
+  }
+  return 0;
+}
+
+/* one table of the n keys ks, put with malloc'd keys and values as the
+   driver does, with or without inline keys: heap bytes per entry and ns
+   per lookup in random order */
+static void inline_row(const char *label, char **ks, unsigned long n,
+                       int no_inline) {
+  ht_config_t cfg = { 0 };
+  hashtable_t *ht;
+  char **order = malloc(sizeof(char *) * n);
+  unsigned long i, t, lookups = n < 1000000 ? 1000000 : n, found = 0;
+  size_t heap = heap_bytes();
+
+  cfg.no_inline = no_inline;
+  ht = make_hashtable_cfg(n, &cfg);
+  for (i=0; i<n; i++) {
+    ht_put(ht, strdup(ks[i]), strdup("v"));
+  }
+  heap = heap_bytes() - heap;
+  memcpy(order, ks, sizeof(char *) * n);
+  shuffle(order, n);
+  t = now_ns();
+  for (i=0; i<lookups; i++) {
+    found += ht_get(ht, order[i % n]) != NULL;
+  }
+  t = now_ns() - t;
+  printf("%-14s %-7s %8lu %10lu %12.1f %10.1f\n", label,
+         no_inline ? "no" : "yes", n, ht->nodes.objsize,
+         (double)heap / n, (double)t / lookups);
+  if (found != lookups) {
+    printf("lost keys?\n");
+  }
+  free_hashtable(ht);
+  free(order);
+}
+
+static int bench_inline(int argc, char **argv) {
+  unsigned long n = 1UL << 20, i, j;
+  char **ks, **longks, *buf;
+  hashtable_t *ht;
+  int s;
+
+  srandom(351);
+  printf("%-14s %-7s %8s %10s %12s %10s\n", "keys", "inline", "entries",
+         "node bytes", "bytes/entry", "ns/get");
+  if (argc > 0) {
+    ht = load_trace_keys(argc, argv);
+    for (s=0; s<2; s++) {
+      inline_row("trace keys", keys, nkeys, s);
+    }
+    free(keys);
+    free_hashtable(ht);
+  }
+  ks = make_keys(n, &buf);
+  longks = malloc(sizeof(char *) * n);
+  for (i=0; i<n; i++) {
+    longks[i] = malloc(33);
+    for (j=0; j<32; j++) {
+      longks[i][j] = 'a' + random() % 26;
+    }
+    longks[i][32] = '\0';
+  }
+  for (s=0; s<2; s++) {
+    inline_row("k<i> (1M)", ks, n, s);
+  }
+  for (s=0; s<2; s++) {
+    inline_row("32 bytes (1M)", longks, n, s);
+  }
+  for (i=0; i<n; i++) {
+    free(longks[i]);
+  }
+  free(longks);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+HT_DEFINE(u64map, uint64_t, uint64_t, ht_hash_u64, ht_eq_scalar)
+
+static void typed_row(const char *label, unsigned long n, double put_ns,
+                      double get_ns, size_t heap) {
+  printf("%-26s %10.2f %10.2f %12.1f\n", label, 1e3 / put_ns, 1e3 / get_ns,
+         (double)heap / n);
+}
+
+/* u64map against the generic table on the same random 64-bit keys, the
+   latter with the keys formatted up front and (as a caller holding
+   integers must) formatted on every call; u64map_del is checked too */
+static int bench_typed(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long i, j, t, found, tmp, bad;
+  uint64_t *ks = malloc(sizeof(uint64_t) * n), *order, *v, sum;
+  char **strs, *buf, key[24];
+  u64map_t *tt;
+  hashtable_t *ht;
+  size_t heap;
+  int fmt;
+
+  if (n == 0) {
+    return -1;
+  }
+  srandom(351);
+  order = malloc(sizeof(uint64_t) * n);
+  for (i=0; i<n; i++) {
+    ks[i] = order[i] = ht_hash_u64(i + 1); /* distinct, since it is a bijection */
+  }
+  for (i=n-1; i>0; i--) {
+    j = random() % (i + 1);
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  printf("%lu random uint64_t keys\n", n);
+  printf("%-26s %10s %10s %12s\n", "", "put Mop/s", "get Mop/s",
+         "bytes/entry");
+
+  heap = heap_bytes();
+  t = now_ns();
+  tt = u64map_make(n);
+  for (i=0; i<n; i++) {
+    u64map_put(tt, ks[i], i);
+  }
+  t = now_ns() - t;
+  heap = heap_bytes() - heap;
+  sum = 0;
+  j = now_ns();
+  for (i=0; i<n; i++) {
+    if ((v = u64map_get(tt, order[i]))) {
+      sum += *v;
+    }
+  }
+  typed_row("u64map (htgen.h)", n, (double)t / n, (double)(now_ns() - j) / n,
+            heap);
+  if (sum != n * (n - 1) / 2) {
+    printf("lost keys?\n");
+  }
+  /* backward shift is easy to get wrong: delete every third key, then
+     the rest must still be found, with their values, and those not */
+  bad = 0;
+  for (i=0; i<n; i+=3) {
+    bad += u64map_del(tt, ks[i]) != 1;
+    bad += u64map_del(tt, ks[i]) != 0;
+  }
+  for (i=0; i<n; i++) {
+    v = u64map_get(tt, ks[i]);
+    bad += i % 3 == 0 ? v != NULL : !v || *v != i;
+  }
+  bad += tt->count != n - (n + 2) / 3;
+  if (bad) {
+    printf("u64map_del: %lu keys wrong, or the count, after deleting every"
+           " third\n", bad);
+  }
+  u64map_free(tt);
+
+  strs = malloc(sizeof(char *) * n);
+  buf = malloc(n * 21);
+  for (fmt=0; fmt<2; fmt++) {
+    for (i=0, j=0; i<n; i++) {
+      strs[i] = buf + j;
+      j += sprintf(buf + j, "%lu", (unsigned long)order[i]) + 1;
+    }
+    heap = heap_bytes();
+    t = now_ns();
+    ht = make_hashtable(n);
+    for (i=0; i<n; i++) {
+      sprintf(key, "%lu", (unsigned long)ks[i]);
+      v = malloc(sizeof(uint64_t));
+      *v = i;
+      ht_put(ht, strdup(key), v);
+    }
+    t = now_ns() - t;
+    heap = heap_bytes() - heap;
+    found = 0;
+    j = now_ns();
+    for (i=0; i<n; i++) {
+      if (fmt) {
+        sprintf(key, "%lu", (unsigned long)order[i]);
+        found += ht_get(ht, key) != NULL;
+      } else {
+        found += ht_get(ht, strs[i]) != NULL;
+      }
+    }
+    typed_row(fmt ? "char * (sprintf per get)" : "char * (keys preformatted)",
+              n, (double)t / n, (double)(now_ns() - j) / n, heap);
+    if (found != n) {
+      printf("lost keys?\n");
+    }
+    free_hashtable(ht);
+  }
+  free(strs);
+  free(buf);
+  free(order);
+  free(ks);
+  return bad != 0;
+}
+
+static int cmp_ulong(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned long max_chain(hashtable_t *ht) {
+  unsigned long i, n, max = 0;
+  bucket_t *b;
+  for (i=0; i<ht->size; i++) {
+    for (n = 0, b = ht->buckets[i]; b; b = b->next) {
+      n++;
+    }
+    if (n > max) {
+      max = n;
+    }
+  }
+  return max;
+}
+
+/* n keys of "Ez"/"FY" blocks, all with the same DJB hash, put into a
+   table with and without tree bins and a seeded hash; each lookup is
+   timed on its own, for the worst case as well as the mean */
+static int bench_attack(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 14;
+  unsigned long *ns, i, t, blocks = 1, b;
+  char **ks, *buf, *p;
+  ht_config_t cfg;
+  hashtable_t *ht;
+  int c;
+
+  if (n < 2) {
+    return -1;
+  }
+  while ((1UL << blocks) < n) {
+    blocks++;
+  }
+  ks = malloc(sizeof(char *) * n);
+  p = buf = malloc(n * (2 * blocks + 1));
+  for (i=0; i<n; i++) {
+    ks[i] = p;
+    for (b=0; b<blocks; b++) {
+      memcpy(p, (i >> b) & 1 ? "FY" : "Ez", 2);
+      p += 2;
+    }
+    *p++ = '\0';
+  }
+  srandom(351);
+  shuffle(ks, n);
+  ns = malloc(sizeof(unsigned long) * n);
+
+  printf("%lu keys with one DJB hash\n", n);
+  printf("%-12s %10s %10s %10s %10s %10s %10s\n", "table", "max chain",
+         "put ms", "mean ns", "p99 ns", "p999 ns", "max ns");
+  for (c=0; c<4; c++) {
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.hashfn = c < 2 ? hash_djb : hash_sip;
+    cfg.tree_bins = c & 1;
+    ht = make_hashtable_cfg(n, &cfg);
+    t = now_ns();
+    for (i=0; i<n; i++) {
+      ht_put_str(ht, ks[i], "v");
+    }
+    t = now_ns() - t;
+    for (i=0; i<n; i++) {
+      ns[i] = now_ns();
+      ht_get(ht, ks[i]);
+      ns[i] = now_ns() - ns[i];
+    }
+    printf("%-12s %10lu %10.1f", c < 2 ? (c ? "djb+trees" : "djb")
+           : (c == 3 ? "sip+trees" : "sip"), max_chain(ht), t / 1e6);
+    t = 0;
+    for (i=0; i<n; i++) {
+      t += ns[i];
+    }
+    qsort(ns, n, sizeof(unsigned long), cmp_ulong);
+    printf(" %10.1f %10lu %10lu %10lu\n", (double)t / n, ns[n * 99 / 100],
+           ns[n * 999 / 1000], ns[n - 1]);
+    free_hashtable(ht);
+  }
+  free(ns);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+static unsigned long scanned;
+static char *seen;              /* by key number, the value of each key */
+
+static int scan_iter(char *key, void *val) {
+  scanned++;
+  return 1;
+}
+
+static void scan_entry(char *key, void *val) {
+  scanned++;
+  seen[strtoul(val, NULL, 10)] = 1;
+}
+
+/* One ht_iter over n/4 entries, timed as a single pause, against ht_scan
+   in slices of 16 buckets with 16 puts or deletes of random keys between
+   slices, three puts to a delete. After the first slice more keys go in
+   until the table resizes, and every one of the n/4 keys not deleted
+   during the scan must still have been seen. */
+static int bench_scan(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long i, t, cursor = 0, slices = 0, total = 0, resizes, *ns;
+  unsigned long cap, r, missed = 0;
+  ht_config_t cfg = { 0 };
+  char **ks, *buf, *gone, num[24];
+  hashtable_t *ht;
+
+  if (n == 0) {
+    return -1;
+  }
+  srandom(351);
+  ks = make_keys(n, &buf);
+  seen = calloc(n, 1);
+  gone = calloc(n, 1);
+  cfg.max_load = 1.0;
+  cfg.min_load = 0.125;
+  ht = make_hashtable_cfg(1024, &cfg);
+  for (i=0; i<n / 4; i++) {
+    sprintf(num, "%lu", i);
+    ht_put_str(ht, ks[i], num);
+  }
+  scanned = 0;
+  t = now_ns();
+  ht_iter(ht, scan_iter);
+  t = now_ns() - t;
+  printf("%lu entries, %lu buckets\n", scanned, ht->size);
+  printf("ht_iter: one pause of %0.2f ms\n", t / 1e6);
+
+  cap = 1024;
+  ns = malloc(sizeof(unsigned long) * cap);
+  resizes = ht->resizes;
+  scanned = 0;
+  do {
+    t = now_ns();
+    cursor = ht_scan(ht, cursor, 16, scan_entry);
+    t = now_ns() - t;
+    if (slices == cap) {
+      ns = realloc(ns, sizeof(unsigned long) * (cap *= 2));
+    }
+    ns[slices++] = t;
+    total += t;
+    for (r = n / 4; slices == 1 && ht->resizes == resizes && r < n; r++) {
+      sprintf(num, "%lu", r);
+      ht_put_str(ht, ks[r], num);
+    }
+    for (i=0; i<16; i++) {
+      r = random() % n;
+      if (random() % 4) {
+        sprintf(num, "%lu", r);
+        ht_put_str(ht, ks[r], num);
+      } else {
+        ht_del(ht, ks[r]);
+        gone[r] = 1;
+      }
+    }
+  } while (cursor);
+  qsort(ns, slices, sizeof(unsigned long), cmp_ulong);
+  printf("ht_scan: %lu slices of 16 buckets, %lu entries seen, %lu resizes"
+         " during the scan\n", slices, scanned, ht->resizes - resizes);
+  printf("  %0.2f ms in all; per slice mean %0.0f ns, p99 %lu ns,"
+         " max %lu ns\n", total / 1e6, (double)total / slices,
+         ns[slices * 99 / 100], ns[slices - 1]);
+  for (i=0; i<n / 4; i++) {
+    missed += !gone[i] && !seen[i];
+  }
+  resizes = ht->resizes - resizes;
+  if (missed || resizes == 0) {
+    printf("ht_scan missed %lu of the entries there throughout, over %lu"
+           " resizes\n", missed, resizes);
+  }
+  free(ns);
+  free(seen);
+  free(gone);
+  free_hashtable(ht);
+  free(ks);
+  free(buf);
+  return missed || resizes == 0;
+}
+
+/* mean ns per lookup of keys ks[0..n), in order, through get */
+static double time_lookups(void *t, void *(*get)(void *, const char *),
+                           char **ks, unsigned long n) {
+  unsigned long i, found = 0, start = now_ns();
+  for (i=0; i<n; i++) {
+    found += get(t, ks[i]) != NULL;
+  }
+  if (found == 0) {
+    printf("no keys found?\n");
+  }
+  return (double)(now_ns() - start) / n;
+}
+
+static void *live_get(void *t, const char *key) {
+  return ht_get(t, (char *)key);
+}
+
+static void *frozen_get(void *t, const char *key) {
+  return ht_frozen_get(t, key);
+}
+
+/* n keys put with ht_put_str, looked up in random order, then frozen and
+   looked up again */
+static int bench_freeze(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long i, t, bad = 0;
+  size_t heap, live_bytes;
+  double live_ns;
+  char **ks, *buf;
+  ht_frozen_t *f;
+  hashtable_t *ht;
+
+  if (n == 0) {
+    return -1;
+  }
+  srandom(351);
+  ks = make_keys(n, &buf);
+  heap = heap_bytes();
+  ht = make_hashtable(n);
+  for (i=0; i<n; i++) {
+    ht_put_str(ht, ks[i], ks[i]);
+  }
+  live_bytes = heap_bytes() - heap;
+  shuffle(ks, n);
+  live_ns = time_lookups(ht, live_get, ks, n);
+
+  t = now_ns();
+  f = ht_freeze(ht);
+  t = now_ns() - t;
+  if (!f) {
+    printf("ht_freeze failed\n");
+    return 1;
+  }
+  for (i=0; i<n; i++) {
+    bad += ht_frozen_get(f, ks[i]) == NULL
+      || strcmp(ht_frozen_get(f, ks[i]), ks[i]) != 0;
+  }
+  if (bad || ht_frozen_get(f, "not a key")) {
+    printf("%lu lookups went wrong!\n", bad);
+  }
+  printf("%lu keys, frozen in %0.1f ms\n", n, t / 1e6);
+  printf("%-8s %12s %10s %10s\n", "", "bytes/key", "ns/get", "Mget/s");
+  printf("%-8s %12.1f %10.1f %10.2f\n", "live", (double)live_bytes / n,
+         live_ns, 1e3 / live_ns);
+  live_ns = time_lookups(f, frozen_get, ks, n);
+  printf("%-8s %12.1f %10.1f %10.2f\n", "frozen",
+         (double)(heap_bytes() - heap) / n, live_ns, 1e3 / live_ns);
+  printf("(%0.2f bits of displacement per key)\n",
+         f->nbuckets * 32.0 / n);
+  ht_frozen_free(f);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+static void count_word(void **val, void *ctx) {
+  if (!*val)
+    *val = calloc(1, sizeof(unsigned long));
+  ++*(unsigned long *)*val;
+}
+
+static unsigned long sum_counts;
+
+static int add_count(char *key, void *val) {
+  sum_counts += *(unsigned long *)val;
+  return 1;
+}
+
+/* counts a skewed stream of words three ways: ht_get then ht_put of a
+   new count, ht_get_or_insert, and ht_upsert */
+static int bench_wordcount(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 22;
+  unsigned long k = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  unsigned long i, t, *words, *c, allocs;
+  char **ks, *buf;
+  hashtable_t *ht;
+  void **slot, *v;
+  int way;
+
+  if (n == 0 || k == 0) {
+    return -1;
+  }
+  srandom(351);
+  ks = make_keys(k, &buf);
+  words = malloc(sizeof(unsigned long) * n);
+  for (i=0; i<n; i++) {
+    words[i] = random() % k * (random() % k) / k; /* skewed to the front */
+  }
+  printf("%lu words, %lu distinct\n", n, k);
+  printf("%-18s %10s %12s %10s\n", "", "ns/word", "mallocs/word", "total");
+  for (way=0; way<3; way++) {
+    ht = make_hashtable(k);
+    allocs = 0;
+    t = now_ns();
+    for (i=0; i<n; i++) {
+      switch (way) {
+      case 0:
+        c = malloc(sizeof(unsigned long));
+        *c = (v = ht_get(ht, ks[words[i]])) ? *(unsigned long *)v + 1 : 1;
+        ht_put(ht, strdup(ks[words[i]]), c);
+        allocs += 2;
+        break;
+      case 1:
+        slot = ht_get_or_insert(ht, ks[words[i]]);
+        if (!*slot) {
+          *slot = calloc(1, sizeof(unsigned long));
+          allocs++;
+        }
+        ++*(unsigned long *)*slot;
+        break;
+      case 2:
+        ht_upsert(ht, ks[words[i]], count_word, NULL);
+        break;
+      }
+    }
+    t = now_ns() - t;
+    sum_counts = 0;
+    ht_iter(ht, add_count);
+    if (way == 2) {
+      allocs = ht->count;
+    }
+    printf("%-18s %10.1f %12.3f %10lu\n", way == 0 ? "get then put"
+           : way == 1 ? "ht_get_or_insert" : "ht_upsert",
+           (double)t / n, (double)(allocs + ht->allocs) / n, sum_counts);
+    free_hashtable(ht);
+  }
+  free(words);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+/* one table, rehashed alternately to 2n and n buckets by ht_rehash and
+   then by ht_rehash_parallel at 1..16 threads */
+static int bench_rehash(int argc, char **argv) {
+  unsigned long threads[] = { 0, 1, 2, 4, 8, 16 };
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 22;
+  unsigned long i, r, t, best, serial = 0, found;
+  char **ks, *buf;
+  hashtable_t *ht;
+
+  if (n == 0) {
+    return -1;
+  }
+  srandom(351);
+  ks = make_keys(n, &buf);
+  ht = make_hashtable(n);
+  for (i=0; i<n; i++) {
+    ht_put_str(ht, ks[i], "v");
+  }
+  printf("%lu entries, %ld CPUs online\n", n, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-10s %10s %10s\n", "threads", "best ms", "speedup");
+  for (r=0; r<sizeof(threads)/sizeof(threads[0]); r++) {
+    best = ~0UL;
+    for (i=0; i<4; i++) {
+      t = now_ns();
+      if (threads[r])
+        ht_rehash_parallel(ht, i & 1 ? n : 2 * n, threads[r]);
+      else
+        ht_rehash(ht, i & 1 ? n : 2 * n);
+      t = now_ns() - t;
+      if (t < best)
+        best = t;
+    }
+    if (!threads[r])
+      serial = best;
+    if (threads[r])
+      printf("%-10lu", threads[r]);
+    else
+      printf("%-10s", "ht_rehash");
+    printf(" %10.1f %10.2f\n", best / 1e6, (double)serial / best);
+  }
+  found = 0;
+  for (i=0; i<n; i++) {
+    found += ht_get(ht, ks[i]) != NULL;
+  }
+  if (found != n || ht->count != n) {
+    printf("%lu of %lu keys left after rehashing!\n", found, n);
+  }
+  free_hashtable(ht);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+/* one row per filter size: n keys put, then n absent keys looked up;
+   the false positive rate is read from the filter itself */
+static int bench_bloom(int argc, char **argv) {
+  unsigned long bits[] = { 0, 4, 6, 8, 10, 12, 16 };
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long i, t, fp, found, miss_ns, hit_ns;
+  char **ks, **absent, *buf, *abuf, *p;
+  ht_config_t cfg = { 0 };
+  hashtable_t *ht;
+  int b;
+
+  if (n == 0) {
+    return -1;
+  }
+  cfg.hashfn = hash_djb;        /* the filter is probed with hash() below */
+  srandom(351);
+  ks = make_keys(n, &buf);
+  absent = malloc(sizeof(char *) * n);
+  p = abuf = malloc(n * 24);
+  for (i=0; i<n; i++) {
+    absent[i] = p;
+    p += sprintf(p, "m%lu", (i * 2654435761UL) % (n * 4)) + 1;
+  }
+  shuffle(ks, n);
+  printf("%lu entries, %lu absent keys\n", n, n);
+  printf("%8s %4s %10s %10s %10s %10s %10s\n", "bits", "k", "filter KB",
+         "B/entry", "FP rate", "miss ns", "hit ns");
+  for (b=0; b<sizeof(bits)/sizeof(bits[0]); b++) {
+    cfg.bloom_bits = bits[b];
+    ht = make_hashtable_cfg(n, &cfg);
+    for (i=0; i<n; i++) {
+      ht_put_str(ht, ks[i], "v");
+    }
+    fp = 0;
+    if (bits[b]) {
+      for (i=0; i<n; i++) {
+        fp += bloom_maybe(&ht->bloom, hash(absent[i]));
+      }
+    }
+    found = 0;
+    t = now_ns();
+    for (i=0; i<n; i++) {
+      found += ht_get(ht, absent[i]) != NULL;
+    }
+    miss_ns = now_ns() - t;
+    t = now_ns();
+    for (i=0; i<n; i++) {
+      found += ht_get(ht, ks[i]) == NULL;
+    }
+    hit_ns = now_ns() - t;
+    if (found) {
+      printf("%lu lookups went wrong!\n", found);
+    }
+    printf("%8lu %4d %10.1f %10.2f %10.4f %10.1f %10.1f\n", bits[b],
+           ht->bloom.k, bloom_bytes(&ht->bloom) / 1024.0,
+           (double)bloom_bytes(&ht->bloom) / n,
+           bits[b] ? (double)fp / n : 1.0,
+           (double)miss_ns / n, (double)hit_ns / n);
+    free_hashtable(ht);
+  }
+  free(absent);
+  free(abuf);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+/* builds a table from a trace the way the driver does, minus the output */
+static hashtable_t *rebuild(const char *filename, trace_t **tp) {
+  trace_t *t = load_trace(filename);
+  hashtable_t *ht;
+  unsigned long i;
+
+  if (!t) {
+    printf("Error opening tracefile %s\n", filename);
+    exit(1);
+  }
+  ht = make_hashtable(t->size);
+  for (i=0; i<t->nops; i++) {
+    switch (t->ops[i].type) {
+    case 'p':
+      ht_put(ht, strdup(t->ops[i].key), strdup(t->ops[i].val));
+      break;
+    case 'd':
+      ht_del(ht, t->ops[i].key);
+      break;
+    case 'r':
+      ht_rehash(ht, t->ops[i].n);
+      break;
+    }
+  }
+  *tp = t;
+  return ht;
+}
+
+/* evicts a file from the page cache, so the next mapping faults in
+   from disk (or at least from outside the cache) */
+static void drop_cache(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+/* times the first lookup of key, then a pass over every put key */
+static void time_gets(const char *label, double startup_ms, hashtable_t *ht,
+                      trace_t *t, char *key) {
+  unsigned long t0, first, i, n = 0;
+  volatile unsigned long found = 0;
+
+  t0 = now_ns();
+  found += ht_get(ht, key) != NULL;
+  first = now_ns() - t0;
+  t0 = now_ns();
+  for (i=0; i<t->nops; i++) {
+    if (t->ops[i].type == 'p') {
+      found += ht_get(ht, t->ops[i].key) != NULL;
+      n++;
+    }
+  }
+  printf("%-22s %12.3f %14lu %12.1f\n", label, startup_ms, first,
+         (double)(now_ns() - t0) / n);
+}
+
+static int bench_snap(int argc, char **argv) {
+  const char *path;
+  hashtable_t *ht, *mht;
+  trace_t *t;
+  struct stat st;
+  char *key = NULL, *v, *mv;
+  unsigned long t0, i, bad = 0;
+  int pass;
+
+  if (argc < 1) {
+    return -1;
+  }
+  path = argc > 1 ? argv[1] : "htbench.snap";
+  printf("%-22s %12s %14s %12s\n", "", "startup ms", "first get ns",
+         "mean get ns");
+
+  t0 = now_ns();
+  ht = rebuild(argv[0], &t);
+  for (i=0; i<t->nops; i++) {
+    if (t->ops[i].type == 'p') {
+      key = t->ops[i].key;
+    }
+  }
+  if (!key) {
+    printf("no p directives in %s\n", argv[0]);
+    return 0;
+  }
+  time_gets("rebuild from trace", (now_ns() - t0) / 1e6, ht, t, key);
+
+  t0 = now_ns();
+  if (ht_save(ht, path) < 0) {
+    perror(path);
+    exit(1);
+  }
+  stat(path, &st);
+  printf("%-22s %12.3f   (%ld bytes)\n", "ht_save", (now_ns() - t0) / 1e6,
+         (long)st.st_size);
+
+  for (pass=0; pass<2; pass++) {
+    if (pass == 0) {
+      drop_cache(path);
+    }
+    t0 = now_ns();
+    if (!(mht = ht_open_mapped(path))) {
+      perror(path);
+      exit(1);
+    }
+    time_gets(pass == 0 ? "mapped (cache dropped)" : "mapped (cached)",
+              (now_ns() - t0) / 1e6, mht, t, key);
+    if (pass == 1) {
+      /* the mapped table must answer exactly as the rebuilt one does */
+      for (i=0; i<t->nops; i++) {
+        if (t->ops[i].type == 'p' || t->ops[i].type == 'g') {
+          v = ht_get(ht, t->ops[i].key);
+          mv = ht_get(mht, t->ops[i].key);
+          bad += (v == NULL) != (mv == NULL) || (v && strcmp(v, mv) != 0);
+        }
+      }
+      if (bad) {
+        printf("%lu lookups differ between the tables!\n", bad);
+      }
+    }
+    free_hashtable(mht);
+  }
+  free_hashtable(ht);
+  free_trace(t);
+  return 0;
+}
+
+/* n puts logged by wal_put at each group commit setting, then the last
+   log recovered; syncing every put is held to a few thousand of them */
+static int bench_wal(int argc, char **argv) {
+  static const struct {
+    const char *name;
+    wal_config_t cfg;
+  } runs[] = {
+    { "fsync per op", { 0, 0, 0 } },
+    { "group of 8", { 8, 0, 0 } },
+    { "group of 64", { 64, 0, 0 } },
+    { "group of 512", { 512, 0, 0 } },
+    { "group of 4096", { 4096, 0, 0 } },
+    { "group of 256 KiB", { 0, 256 << 10, 0 } },
+    { "every 10 ms", { 0, 0, 10 } },
+  };
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 200000;
+  const char *path = argc > 1 ? argv[1] : "htbench.wal";
+  unsigned long r, i, ops, t, found;
+  char **ks, *buf, *v;
+  hashtable_t *ht;
+  wal_t *w;
+
+  if (n == 0) {
+    return -1;
+  }
+  ks = make_keys(n, &buf);
+  printf("%-18s %10s %10s %12s %12s\n", "", "puts", "groups", "puts/sec",
+         "MB/sec");
+  for (r=0; r<sizeof(runs)/sizeof(runs[0]); r++) {
+    unlink(path);
+    if (!(w = wal_open(path, &runs[r].cfg))) {
+      perror(path);
+      exit(1);
+    }
+    ht = make_hashtable(n);
+    ops = r == 0 && n > 5000 ? 5000 : n;
+    t = now_ns();
+    for (i=0; i<ops; i++) {
+      if (wal_put(w, ht, ks[i], ks[(i + 1) % n]) < 0) {
+        perror(path);
+        exit(1);
+      }
+    }
+    wal_sync(w);
+    t = now_ns() - t;
+    printf("%-18s %10lu %10lu %12.0f %12.1f\n", runs[r].name, ops,
+           w->groups, ops / (t / 1e9), w->bytes / (t / 1e3));
+    wal_close(w);
+    free_hashtable(ht);
+  }
+
+  t = now_ns();
+  if (!(ht = wal_recover(path, NULL))) {
+    perror(path);
+    exit(1);
+  }
+  t = now_ns() - t;
+  printf("recovered %lu entries in %0.1f ms (%0.0f records/sec)\n",
+         ht->count, t / 1e6, n / (t / 1e9));
+  found = 0;
+  for (i=0; i<n; i++) {
+    v = ht_get(ht, ks[i]);
+    found += v && strcmp(v, ks[(i + 1) % n]) == 0;
+  }
+  if (found != n) {
+    printf("%lu of %lu entries recovered intact!\n", found, n);
+  }
+  free_hashtable(ht);
+  unlink(path);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+/* the counters ht_stats copies out against the walk print_ht_stats used
+   to make over every chain, at table sizes up to n entries */
+static int bench_stats(int argc, char **argv) {
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 22;
+  unsigned long size, i, j, t, walk_ns, stats_ns, nodes, chains, max, len;
+  char **ks, *buf;
+  hashtable_t *ht;
+  ht_stats_t st;
+  bucket_t *b;
+
+  if (n == 0) {
+    return -1;
+  }
+  ks = make_keys(n, &buf);
+  printf("%-10s %14s %14s %10s\n", "entries", "walk us", "ht_stats ns",
+         "max chain");
+  for (size = n >= 1024 ? 1024 : n; size <= n; size *= 4) {
+    ht = make_hashtable(size);
+    for (i=0; i<size; i++) {
+      ht_put_str(ht, ks[i], "v");
+    }
+    t = now_ns();
+    nodes = chains = max = 0;
+    for (i=0; i<ht->size; i++) {
+      for (len = 0, b = ht->buckets[i]; b; b = b->next) {
+        len++;
+      }
+      nodes += len;
+      chains += len > 0;
+      if (len > max) {
+        max = len;
+      }
+    }
+    walk_ns = now_ns() - t;
+    t = now_ns();
+    for (j=0; j<1000; j++) {
+      ht_stats(ht, &st);
+    }
+    stats_ns = (now_ns() - t) / 1000;
+    if (st.total_len != nodes || st.size - st.hist[0] != chains
+        || st.max_len != max) {
+      printf("ht_stats disagrees with the walk!\n");
+    }
+    printf("%-10lu %14.1f %14lu %10lu\n", size, walk_ns / 1e3, stats_ns,
+           st.max_len);
+    free_hashtable(ht);
+  }
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+static char **doomed;
+static unsigned long ndoomed, keep_every;
+
+/* a key "k<i>" survives if i is a multiple of keep_every */
+static int purge_pred(char *key, void *val, void *ctx) {
+  return strtoul(key + 1, NULL, 10) % keep_every != 0;
+}
+
+static int collect_doomed(char *key, void *val) {
+  if (purge_pred(key, val, NULL)) {
+    doomed[ndoomed++] = key;
+  }
+  return 1;
+}
+
+/* one row per fraction removed from an automatically resized table:
+   ht_iter collecting the keys and ht_del on each, against ht_purge, with
+   the buckets (old and new, if migrating) left afterwards */
+static int bench_purge(int argc, char **argv) {
+  unsigned long keeps[] = { 2, 10, 100 };
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long i, t, del_ns, purge_ns, removed, full;
+  ht_config_t cfg = { 0 };
+  hashtable_t *a, *b;
+  char **ks, *buf;
+  int k;
+
+  if (n == 0) {
+    return -1;
+  }
+  cfg.max_load = 1.0;
+  cfg.min_load = 0.125;
+  ks = make_keys(n, &buf);
+  doomed = malloc(sizeof(char *) * n);
+  printf("%lu entries\n", n);
+  printf("%8s %12s %12s %12s %12s %12s\n", "removed", "iter+del ms",
+         "purge ms", "buckets", "iter+del", "purge");
+  for (k=0; k<sizeof(keeps)/sizeof(keeps[0]); k++) {
+    keep_every = keeps[k];
+    a = make_hashtable_cfg(1024, &cfg);
+    b = make_hashtable_cfg(1024, &cfg);
+    for (i=0; i<n; i++) {
+      ht_put_str(a, ks[i], "v");
+      ht_put_str(b, ks[i], "v");
+    }
+    full = a->size + a->old_size;
+
+    t = now_ns();
+    ndoomed = 0;
+    ht_iter(a, collect_doomed);
+    for (i=0; i<ndoomed; i++) {
+      ht_del(a, doomed[i]);
+    }
+    del_ns = now_ns() - t;
+
+    t = now_ns();
+    removed = ht_purge(b, purge_pred, NULL);
+    purge_ns = now_ns() - t;
+    if (removed != ndoomed || a->count != b->count) {
+      printf("ht_purge removed %lu entries, not %lu!\n", removed, ndoomed);
+    }
+    printf("%7.0f%% %12.1f %12.1f %12lu %12lu %12lu\n",
+           100.0 - 100.0 / keeps[k], del_ns / 1e6, purge_ns / 1e6, full,
+           a->size + a->old_size, b->size + b->old_size);
+    free_hashtable(a);
+    free_hashtable(b);
+  }
+  free(doomed);
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+/* nsamples draws of ks[] by a Zipf distribution of skew theta, ks[0]
+   the most popular */
+static char **zipf_keys(char **ks, unsigned long n, double theta,
+                        unsigned long nsamples) {
+  double *cdf = malloc(sizeof(double) * n), sum = 0, u;
+  char **out = malloc(sizeof(char *) * nsamples);
+  unsigned long i, lo, hi, mid;
+
+  for (i=0; i<n; i++) {
+    sum += 1.0 / pow(i + 1, theta);
+    cdf[i] = sum;
+  }
+  for (i=0; i<nsamples; i++) {
+    u = random() / (RAND_MAX + 1.0) * sum;
+    for (lo = 0, hi = n - 1; lo < hi; ) {
+      mid = (lo + hi) / 2;
+      if (cdf[mid] < u)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    out[i] = ks[lo];
+  }
+  free(cdf);
+  return out;
+}
+
+/* one row per skew: ns per ht_get of Zipf-distributed keys without a
+   front cache, and the hit ratio and ns per get with one of each size */
+static int bench_front(int argc, char **argv) {
+  double thetas[] = { 0.8, 0.9, 1.0, 1.1, 1.2 };
+  unsigned long slots[] = { 0, 1024, 16384 };
+  unsigned long n = argc > 0 ? strtoul(argv[0], NULL, 10) : 1UL << 20;
+  unsigned long nsamples = 1UL << 22, i, t, hits, gets, missing;
+  hashtable_t *ht[3];
+  ht_config_t cfg = { 0 };
+  char **ks, **samples, *buf;
+  int th, s;
+
+  if (n == 0) {
+    return -1;
+  }
+  srandom(351);
+  ks = make_keys(n, &buf);
+  shuffle(ks, n);
+  for (s=0; s<3; s++) {
+    cfg.front_slots = slots[s];
+    ht[s] = make_hashtable_cfg(n, &cfg);
+    for (i=0; i<n; i++) {
+      ht_put_str(ht[s], ks[i], "v");
+    }
+  }
+  printf("%lu entries, %lu gets per row\n", n, nsamples);
+  printf("%6s %10s", "theta", "none ns");
+  for (s=1; s<3; s++) {
+    printf(" %7lu hit%% %7lu ns", slots[s], slots[s]);
+  }
+  printf("\n");
+  for (th=0; th<sizeof(thetas)/sizeof(thetas[0]); th++) {
+    samples = zipf_keys(ks, n, thetas[th], nsamples);
+    printf("%6.1f", thetas[th]);
+    for (s=0; s<3; s++) {
+      hits = ht[s]->stats.front_hits;
+      gets = hits + ht[s]->stats.front_misses;
+      missing = 0;
+      t = now_ns();
+      for (i=0; i<nsamples; i++) {
+        missing += ht_get(ht[s], samples[i]) == NULL;
+      }
+      t = now_ns() - t;
+      if (missing) {
+        printf("%lu lookups went wrong!\n", missing);
+      }
+      hits = ht[s]->stats.front_hits - hits;
+      gets = ht[s]->stats.front_hits + ht[s]->stats.front_misses - gets;
+      if (s == 0) {
+        printf(" %10.1f", (double)t / nsamples);
+      } else {
+        printf(" %11.1f%% %10.1f", 100.0 * hits / gets, (double)t / nsamples);
+      }
+    }
+    printf("\n");
+    free(samples);
+  }
+  for (s=0; s<3; s++) {
+    free_hashtable(ht[s]);
+  }
+  free(ks);
+  free(buf);
+  return 0;
+}
+
+static struct {
+  const char *name;
+  int (*run)(int argc, char **argv);
+  const char *args;
+  const char *help;
+} modes[] = {
+  { "hash", bench_hash, "TRACEFILE...",
+    "ns per hash and chain-length histograms for each hash function" },
+  { "batch", bench_batch, "[MAX_ENTRIES]",
+    "ht_get against ht_get_many at batch sizes 4..256, 4K..4M entries" },
+  { "snap", bench_snap, "TRACEFILE [SNAPFILE]",
+    "startup and lookups: rebuilding from a trace against ht_open_mapped" },
+  { "inline", bench_inline, "[TRACEFILE...]",
+    "bytes per entry and ns per lookup with and without inline keys" },
+  { "typed", bench_typed, "[ENTRIES]",
+    "an htgen.h uint64_t table against the char * table" },
+  { "attack", bench_attack, "[KEYS]",
+    "lookup latency under colliding keys, with and without trees and SipHash" },
+  { "scan", bench_scan, "[ENTRIES]",
+    "pause of one ht_iter against the worst slice of an ht_scan" },
+  { "freeze", bench_freeze, "[ENTRIES]",
+    "build time, bytes per key and lookups of ht_freeze against the live table" },
+  { "wordcount", bench_wordcount, "[WORDS [DISTINCT]]",
+    "counting words by ht_get and ht_put against ht_get_or_insert/ht_upsert" },
+  { "rehash", bench_rehash, "[ENTRIES]",
+    "ht_rehash wall time against ht_rehash_parallel at 1..16 threads" },
+  { "bloom", bench_bloom, "[ENTRIES]",
+    "false positives, memory and miss latency against Bloom filter size" },
+  { "stats", bench_stats, "[ENTRIES]",
+    "ht_stats against walking every chain, at sizes up to ENTRIES" },
+  { "wal", bench_wal, "[ENTRIES [LOGFILE]]",
+    "write-ahead logged puts/sec by group commit size, and recovery time" },
+  { "front", bench_front, "[ENTRIES]",
+    "front cache hit ratio and ns per get for Zipf skews 0.8..1.2" },
+  { "purge", bench_purge, "[ENTRIES]",
+    "ht_purge against ht_iter and ht_del, in time and bytes left after" },
+  { NULL, NULL, NULL, NULL }
+};
+
+static void usage(char *prog) {
+  int i;
+  printf("Usage: %s MODE [ARGS...]\n", prog);
+  for (i=0; modes[i].name; i++) {
+    printf("  %s %s\n      %s\n", modes[i].name, modes[i].args,
+           modes[i].help);
+  }
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  int i, r;
+  if (argc < 2) {
+    usage(argv[0]);
+  }
+  for (i=0; modes[i].name; i++) {
+    if (strcmp(argv[1], modes[i].name) == 0) {
+      if ((r = modes[i].run(argc - 2, argv + 2)) < 0) {
+        usage(argv[0]);
+      }
+      return r;
+    }
+  }
+  usage(argv[0]);
+  return 0;
+}
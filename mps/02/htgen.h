@@ -0,0 +1,142 @@
+#ifndef HTGEN_H
+#define HTGEN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Type-specialized hashtables. HT_DEFINE(name, key_t, val_t, hashf, eqf)
+   generates name_t, a table mapping key_t to val_t, with
+
+     name_t *name_make(unsigned long size);
+     val_t  *name_get(name_t *ht, key_t key);      NULL if absent
+     val_t  *name_put(name_t *ht, key_t key, val_t val);
+     int     name_del(name_t *ht, key_t key);      1 if key was there
+     void    name_iter(name_t *ht, int (*f)(key_t, val_t *));
+     void    name_free(name_t *ht);
+
+   hashf(key) returns an unsigned long and eqf(a, b) is nonzero iff two
+   keys are equal; both are expanded in place, so they can be macros.
+   Keys and values are stored by value in one flat array, probed
+   linearly, so nothing is allocated per entry and nothing is ever
+   freed but the array: a pointer from name_get or name_put stays valid
+   until the next name_put or name_del. */
+
+/* a 64-bit finalizer (from MurmurHash3); integer keys are often small
+   or sequential, and the table indexes by the low bits */
+static inline unsigned long ht_hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+#define ht_eq_scalar(a, b) ((a) == (b))
+
+#define HT_DEFINE(name, key_t, val_t, hashf, eqf)                           \
+                                                                            \
+typedef struct name {                                                       \
+  unsigned long size;           /* slots, a power of two */                 \
+  unsigned long count;                                                      \
+  unsigned char *used;                                                      \
+  struct name##_slot {                                                      \
+    key_t key;                                                              \
+    val_t val;                                                              \
+  } *slots;                                                                 \
+} name##_t;                                                                 \
+                                                                            \
+static inline void name##_alloc(name##_t *ht, unsigned long size) {         \
+  unsigned long n = 8;                                                      \
+  while (n < size)                                                          \
+    n <<= 1;                                                                \
+  ht->size = n;                                                             \
+  ht->count = 0;                                                            \
+  ht->used = calloc(n, 1);                                                  \
+  ht->slots = malloc(sizeof(struct name##_slot) * n);                       \
+}                                                                           \
+                                                                            \
+static inline name##_t *name##_make(unsigned long size) {                   \
+  name##_t *ht = malloc(sizeof(name##_t));                                  \
+  name##_alloc(ht, size * 4 / 3 + 1);                                       \
+  return ht;                                                                \
+}                                                                           \
+                                                                            \
+/* slot holding key, or the empty slot ending its probe sequence */         \
+static inline unsigned long name##_find(name##_t *ht, key_t key) {          \
+  unsigned long mask = ht->size - 1, i = (hashf(key)) & mask;               \
+  while (ht->used[i] && !(eqf(ht->slots[i].key, key)))                      \
+    i = (i + 1) & mask;                                                     \
+  return i;                                                                 \
+}                                                                           \
+                                                                            \
+static inline val_t *name##_get(name##_t *ht, key_t key) {                  \
+  unsigned long i = name##_find(ht, key);                                   \
+  return ht->used[i] ? &ht->slots[i].val : NULL;                            \
+}                                                                           \
+                                                                            \
+static inline void name##_grow(name##_t *ht) {                              \
+  unsigned char *used = ht->used;                                           \
+  struct name##_slot *slots = ht->slots;                                    \
+  unsigned long i, j, oldsize = ht->size, count = ht->count;                \
+  name##_alloc(ht, oldsize * 2);                                            \
+  for (i=0; i<oldsize; i++) {                                               \
+    if (used[i]) {                                                          \
+      j = name##_find(ht, slots[i].key);                                    \
+      ht->used[j] = 1;                                                      \
+      ht->slots[j] = slots[i];                                              \
+    }                                                                       \
+  }                                                                         \
+  ht->count = count;                                                        \
+  free(used);                                                               \
+  free(slots);                                                              \
+}                                                                           \
+                                                                            \
+/* inserts or replaces; kept at most 3/4 full */                            \
+static inline val_t *name##_put(name##_t *ht, key_t key, val_t val) {       \
+  unsigned long i = name##_find(ht, key);                                   \
+  if (!ht->used[i]) {                                                       \
+    if ((ht->count + 1) * 4 > ht->size * 3) {                               \
+      name##_grow(ht);                                                      \
+      i = name##_find(ht, key);                                             \
+    }                                                                       \
+    ht->used[i] = 1;                                                        \
+    ht->slots[i].key = key;                                                 \
+    ht->count++;                                                            \
+  }                                                                         \
+  ht->slots[i].val = val;                                                   \
+  return &ht->slots[i].val;                                                 \
+}                                                                           \
+                                                                            \
+/* backward-shift deletion: entries after the hole that may not probe       \
+   past it are moved up, so lookups never need tombstones */                \
+static inline int name##_del(name##_t *ht, key_t key) {                     \
+  unsigned long mask = ht->size - 1, i = name##_find(ht, key), j, home;     \
+  if (!ht->used[i])                                                         \
+    return 0;                                                               \
+  for (j = (i + 1) & mask; ht->used[j]; j = (j + 1) & mask) {               \
+    home = (hashf(ht->slots[j].key)) & mask;                                \
+    if (((j - home) & mask) >= ((j - i) & mask)) {                          \
+      ht->slots[i] = ht->slots[j];                                          \
+      i = j;                                                                \
+    }                                                                       \
+  }                                                                         \
+  ht->used[i] = 0;                                                          \
+  ht->count--;                                                              \
+  return 1;                                                                 \
+}                                                                           \
+                                                                            \
+static inline void name##_iter(name##_t *ht, int (*f)(key_t, val_t *)) {    \
+  unsigned long i;                                                          \
+  for (i=0; i<ht->size; i++)                                                \
+    if (ht->used[i] && !f(ht->slots[i].key, &ht->slots[i].val))             \
+      return;                                                               \
+}                                                                           \
+                                                                            \
+static inline void name##_free(name##_t *ht) {                              \
+  free(ht->used);                                                           \
+  free(ht->slots);                                                          \
+  free(ht);                                                                 \
+}
+
+#endif
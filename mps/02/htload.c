@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "htserver.h"
+#include "trace.h"
+
+/* Load generator for htserver: replays a tracefile over many connections
+   at once, each keeping up to a pipeline depth of requests in flight,
+   and reports requests/sec and latency percentiles. Op i of the trace
+   goes to connection i % conns, so each connection sees its share of the
+   trace in order. */
+
+#define MAX_EVENTS 64
+
+typedef struct client {
+  int fd;
+  unsigned long nops;           /* trace ops of this connection, per pass */
+  unsigned long total;          /* requests to send, over all passes */
+  unsigned long sent, recvd;
+  unsigned long *t_sent;        /* send times, a ring of depth entries */
+  char *wbuf;
+  unsigned long woff, wlen;
+  int want_out;
+  int line_start;               /* next byte read starts a reply */
+} client_t;
+
+static int conns = 64, depth = 16;
+static unsigned long passes = 1;
+static char *reqs;              /* every op as a request line */
+static unsigned long *req_off;  /* op i is reqs[req_off[i]..req_off[i+1]) */
+static unsigned long *lat;      /* one latency per reply, in ns */
+static unsigned long nlat, misses, errors;
+static int epfd;
+
+static unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* encodes the trace's ops as request lines, once, up front */
+static void encode(trace_t *t) {
+  unsigned long i, len = 0;
+  trace_op_t *op;
+
+  for (i=0; i<t->nops; i++) {
+    op = &t->ops[i];
+    len += 24 + (op->key ? strlen(op->key) : 0)
+      + (op->val ? strlen(op->val) : 0);
+  }
+  reqs = malloc(len);
+  req_off = malloc(sizeof(unsigned long) * (t->nops + 1));
+  len = 0;
+  for (i=0; i<t->nops; i++) {
+    op = &t->ops[i];
+    req_off[i] = len;
+    switch (op->type) {
+    case 'p':
+      len += sprintf(reqs + len, "p %s %s\n", op->key, op->val);
+      break;
+    case 'g':
+    case 'd':
+      len += sprintf(reqs + len, "%c %s\n", op->type, op->key);
+      break;
+    case 'r':
+      len += sprintf(reqs + len, "r %lu\n", op->n);
+      break;
+    default:
+      len += sprintf(reqs + len, "i\n");
+    }
+  }
+  req_off[t->nops] = len;
+}
+
+static int connect_to(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void watch(client_t *c, int out) {
+  struct epoll_event ev;
+  if (out == c->want_out)
+    return;
+  c->want_out = out;
+  ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* tops the pipeline up to depth requests and sends them in one write */
+static int fill(client_t *c, int idx) {
+  unsigned long op, len, t = now_ns();
+  ssize_t n;
+
+  if (c->woff == c->wlen) {
+    c->woff = c->wlen = 0;
+    while (c->sent < c->total && c->sent - c->recvd < (unsigned long)depth) {
+      op = idx + (c->sent % c->nops) * conns;
+      len = req_off[op + 1] - req_off[op];
+      memcpy(c->wbuf + c->wlen, reqs + req_off[op], len);
+      c->wlen += len;
+      c->t_sent[c->sent++ % depth] = t;
+    }
+  }
+  while (c->woff < c->wlen) {
+    n = write(c->fd, c->wbuf + c->woff, c->wlen - c->woff);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return -1;
+      break;
+    }
+    c->woff += n;
+  }
+  watch(c, c->woff < c->wlen);
+  return 0;
+}
+
+/* reads replies, timing each by its request's send time */
+static int drain(client_t *c) {
+  char buf[HTS_BUF_SIZE], *p, *end;
+  unsigned long t;
+  ssize_t n;
+
+  for (;;) {
+    n = read(c->fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return 0;
+    if (n <= 0)
+      return -1;
+    t = now_ns();
+    for (p = buf, end = buf + n; p < end; p++) {
+      if (c->line_start) {
+        if (*p == HTS_MISS[0])
+          misses++;
+        else if (*p == HTS_ERR[0])
+          errors++;
+      }
+      if ((c->line_start = *p == '\n')) {
+        lat[nlat++] = t - c->t_sent[c->recvd++ % depth];
+      }
+    }
+  }
+}
+
+static int cmp_ul(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned long pct(double p) {
+  unsigned long i = p / 100 * nlat;
+  return lat[i < nlat ? i : nlat - 1];
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-s SOCKET] [-c CONNS] [-d DEPTH] [-n PASSES] "
+         "TRACEFILE_NAME\n", prog);
+  printf("  -s SOCKET  server socket (default %s)\n", HTS_SOCKET);
+  printf("  -c CONNS   connections (default 64)\n");
+  printf("  -d DEPTH   requests in flight per connection (default 16)\n");
+  printf("  -n PASSES  times to replay the trace (default 1)\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  struct epoll_event ev, events[MAX_EVENTS];
+  const char *path = HTS_SOCKET;
+  unsigned long total = 0, done = 0, t0, elapsed, longest = 0;
+  client_t *cl, *c;
+  trace_t *t;
+  int opt, i, n;
+
+  while ((opt = getopt(argc, argv, "s:c:d:n:")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 'c':
+      if ((conns = atoi(optarg)) < 1)
+        usage(argv[0]);
+      break;
+    case 'd':
+      if ((depth = atoi(optarg)) < 1)
+        usage(argv[0]);
+      break;
+    case 'n':
+      if (!(passes = strtoul(optarg, NULL, 10)))
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc)
+    usage(argv[0]);
+  if (!(t = load_trace(argv[optind]))) {
+    printf("Error opening tracefile %s\n", argv[optind]);
+    return 1;
+  }
+  if (t->nops < (unsigned long)conns)
+    conns = t->nops;
+  encode(t);
+  for (i=0; i<(long)t->nops; i++) {
+    n = req_off[i + 1] - req_off[i];
+    if ((unsigned long)n > longest)
+      longest = n;
+  }
+
+  epfd = epoll_create1(0);
+  cl = calloc(conns, sizeof(client_t));
+  for (i=0; i<conns; i++) {
+    c = &cl[i];
+    if ((c->fd = connect_to(path)) < 0) {
+      perror(path);
+      return 1;
+    }
+    c->nops = (t->nops - i + conns - 1) / conns;
+    c->total = c->nops * passes;
+    c->t_sent = malloc(sizeof(unsigned long) * depth);
+    c->wbuf = malloc(longest * depth);
+    c->line_start = 1;
+    total += c->total;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+  }
+  lat = malloc(sizeof(unsigned long) * total);
+
+  t0 = now_ns();
+  for (i=0; i<conns; i++) {
+    if (fill(&cl[i], i) < 0) {
+      perror("write");
+      return 1;
+    }
+  }
+  while (done < (unsigned long)conns) {
+    if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return 1;
+    }
+    for (i=0; i<n; i++) {
+      c = events[i].data.ptr;
+      if (c->recvd == c->total)
+        continue;
+      if (((events[i].events & EPOLLIN) && drain(c) < 0)
+          || fill(c, c - cl) < 0) {
+        printf("Connection closed by server\n");
+        return 1;
+      }
+      if (c->recvd == c->total)
+        done++;
+    }
+  }
+  elapsed = now_ns() - t0;
+
+  if (nlat == 0) {
+    printf("No requests\n");   /* an empty trace */
+    return 0;
+  }
+  qsort(lat, nlat, sizeof(unsigned long), cmp_ul);
+  printf("%lu requests over %d connections, depth %d, in %0.3f s: "
+         "%0.0f requests/sec\n", nlat, conns, depth, elapsed / 1e9,
+         nlat / (elapsed / 1e9));
+  printf("Latency (us): p50 %0.1f, p90 %0.1f, p99 %0.1f, p99.9 %0.1f, "
+         "max %0.1f\n", pct(50) / 1e3, pct(90) / 1e3, pct(99) / 1e3,
+         pct(99.9) / 1e3, lat[nlat - 1] / 1e3);
+  printf("Misses = %lu, errors = %lu\n", misses, errors);
+
+  for (i=0; i<conns; i++) {
+    close(cl[i].fd);
+    free(cl[i].t_sent);
+    free(cl[i].wbuf);
+  }
+  free(cl);
+  free(lat);
+  free(reqs);
+  free(req_off);
+  free_trace(t);
+  return 0;
+}
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hashtable.h"
+#include "htserver.h"
+
+/* A key-value server over a Unix domain socket, in front of one chained
+   table. Requests are trace directives, one per line (see htserver.h).
+   One thread runs an epoll loop; each read is parsed in place, every
+   complete line in it answered into the connection's write buffer, and
+   the buffer sent with one write. Nodes come from the table's slab,
+   and keys and values are heap copies owned by the table, so an
+   overwrite or delete gives their memory back and the server's size
+   follows the data it holds: the table's arena would never shrink under
+   puts and deletes. Only a put allocates, its two copies (the key's
+   freed again at once if the key is present or short enough to sit in
+   the node). */
+
+#define MAX_EVENTS 64
+
+typedef struct conn conn_t;
+
+struct conn {
+  int fd;
+  unsigned long rlen;           /* bytes in rbuf */
+  unsigned long woff, wlen;     /* wbuf[woff..wlen) is still to be sent */
+  int want_out;                 /* registered for EPOLLOUT */
+  conn_t *next_free;
+  char rbuf[HTS_BUF_SIZE];
+  char wbuf[2 * HTS_BUF_SIZE];   /* room for one more reply past full */
+};
+
+static volatile sig_atomic_t stopping;
+static int epfd;
+static conn_t *free_conns;      /* closed connections, kept for reuse */
+static unsigned long nconns, nrequests, nbatches;
+
+static void on_signal(int sig) {
+  stopping = 1;
+}
+
+static int set_nonblock(int fd) {
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void close_conn(conn_t *c) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  c->next_free = free_conns;
+  free_conns = c;
+  nconns--;
+}
+
+static void accept_conns(int lfd) {
+  struct epoll_event ev;
+  conn_t *c;
+  int fd;
+
+  while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+    set_nonblock(fd);
+    if ((c = free_conns)) {
+      free_conns = c->next_free;
+    } else {
+      c = malloc(sizeof(conn_t));
+    }
+    c->fd = fd;
+    c->rlen = c->woff = c->wlen = 0;
+    c->want_out = 0;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    nconns++;
+  }
+}
+
+/* appends to the reply; the caller has checked there is room */
+static void reply(conn_t *c, const char *s, unsigned long len) {
+  memcpy(c->wbuf + c->wlen, s, len);
+  c->wlen += len;
+}
+
+/* next space-delimited token of a line, NUL-terminated in place */
+static char *token(char **p) {
+  char *s = *p, *tok;
+  while (*s == ' ' || *s == '\t')
+    s++;
+  if (!*s)
+    return NULL;
+  tok = s;
+  while (*s && *s != ' ' && *s != '\t')
+    s++;
+  if (*s)
+    *s++ = '\0';
+  *p = s;
+  return tok;
+}
+
+/* answers one NUL-terminated request line */
+static void serve_line(hashtable_t *ht, conn_t *c, char *line) {
+  char *p = line, *cmd, *key, *val, *end;
+  unsigned long size;
+  char num[32];
+
+  nrequests++;
+  if (!(cmd = token(&p))) {
+    reply(c, HTS_ERR, sizeof(HTS_ERR) - 1);
+    return;
+  }
+  key = token(&p);
+  switch (cmd[0]) {
+  case 'p':
+    if (!key || !(val = token(&p)))
+      break;
+    ht_put(ht, strdup(key), strdup(val));
+    reply(c, HTS_OK, sizeof(HTS_OK) - 1);
+    return;
+  case 'g':
+    if (!key)
+      break;
+    if ((val = ht_get(ht, key))) {
+      reply(c, HTS_VAL, sizeof(HTS_VAL) - 1);
+      reply(c, val, strlen(val));
+      reply(c, "\n", 1);
+    } else {
+      reply(c, HTS_MISS, sizeof(HTS_MISS) - 1);
+    }
+    return;
+  case 'd':
+    if (!key)
+      break;
+    ht_del(ht, key);
+    reply(c, HTS_OK, sizeof(HTS_OK) - 1);
+    return;
+  case 'r':
+    if (!key || !(size = strtoul(key, &end, 10)) || *end)
+      break;
+    ht_rehash(ht, size);
+    reply(c, HTS_OK, sizeof(HTS_OK) - 1);
+    return;
+  case 'i':
+    reply(c, num, snprintf(num, sizeof(num), "%lu\n", ht->count));
+    return;
+  }
+  reply(c, HTS_ERR, sizeof(HTS_ERR) - 1);
+}
+
+/* sends what is in wbuf, watching for EPOLLOUT if the socket is full;
+   returns -1 if the connection is gone */
+static int flush_conn(conn_t *c) {
+  struct epoll_event ev;
+  ssize_t n;
+
+  while (c->woff < c->wlen) {
+    n = write(c->fd, c->wbuf + c->woff, c->wlen - c->woff);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        return -1;
+      break;
+    }
+    c->woff += n;
+  }
+  if (c->woff == c->wlen)
+    c->woff = c->wlen = 0;
+  if ((c->wlen > 0) != c->want_out) {
+    c->want_out = c->wlen > 0;
+    ev.events = c->want_out ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  return 0;
+}
+
+/* answers every complete line in rbuf, leaving a partial one at the
+   front, and sends the replies. No reply is longer than a line can be,
+   so lines are taken until HTS_BUF_SIZE bytes of replies are waiting;
+   if those cannot all be sent, the rest of the lines stay in rbuf until
+   they have been, which stops reading from a client that does not read
+   its own replies. */
+static int serve_batch(hashtable_t *ht, conn_t *c) {
+  char *line, *end, *nl;
+  int full;
+
+  do {
+    line = c->rbuf;
+    end = c->rbuf + c->rlen;
+    full = 0;
+    while (line < end && (nl = memchr(line, '\n', end - line))) {
+      if ((full = c->wlen >= HTS_BUF_SIZE))
+        break;
+      *nl = '\0';
+      if (nl > line && nl[-1] == '\r')
+        nl[-1] = '\0';
+      serve_line(ht, c, line);
+      line = nl + 1;
+    }
+    c->rlen = end - line;
+    memmove(c->rbuf, line, c->rlen);
+    nbatches++;
+    if (flush_conn(c) < 0)
+      return -1;
+  } while (full && !c->want_out);
+  if (c->rlen == HTS_BUF_SIZE && !full)
+    return -1;                  /* a line longer than the buffer */
+  return 0;
+}
+
+static void read_conn(hashtable_t *ht, conn_t *c) {
+  ssize_t n;
+
+  for (;;) {
+    n = read(c->fd, c->rbuf + c->rlen, HTS_BUF_SIZE - c->rlen);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      return;
+    if (n <= 0) {
+      close_conn(c);
+      return;
+    }
+    c->rlen += n;
+    if (serve_batch(ht, c) < 0) {
+      close_conn(c);
+      return;
+    }
+    if (c->want_out)
+      return;                   /* wait for the replies to drain */
+  }
+}
+
+static void write_conn(hashtable_t *ht, conn_t *c) {
+  if (flush_conn(c) < 0) {
+    close_conn(c);
+    return;
+  }
+  /* requests held back by a full wbuf may now be answered */
+  if (!c->want_out && c->rlen > 0 && serve_batch(ht, c) < 0) {
+    close_conn(c);
+    return;
+  }
+  if (!c->want_out)
+    read_conn(ht, c);
+}
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+      || listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return -1;
+  }
+  set_nonblock(fd);
+  return fd;
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-s SOCKET] [-n SIZE] [-a]\n", prog);
+  printf("  -s SOCKET  listen on this path (default %s)\n", HTS_SOCKET);
+  printf("  -n SIZE    initial table size (default 1024)\n");
+  printf("  -a         grow and shrink the table automatically\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  struct epoll_event ev, events[MAX_EVENTS];
+  struct sigaction sa;
+  ht_config_t cfg = { 0 };
+  const char *path = HTS_SOCKET;
+  unsigned long size = 1024;
+  hashtable_t *ht;
+  conn_t *c;
+  int opt, lfd, i, n;
+
+  while ((opt = getopt(argc, argv, "as:n:")) != -1) {
+    switch (opt) {
+    case 'a':
+      cfg.max_load = 1.0;
+      cfg.min_load = 0.125;
+      break;
+    case 's':
+      path = optarg;
+      break;
+    case 'n':
+      if (!(size = strtoul(optarg, NULL, 10)))
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((lfd = listen_on(path)) < 0) {
+    perror(path);
+    return 1;
+  }
+  epfd = epoll_create1(0);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;           /* the listening socket */
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+  ht = make_hashtable_cfg(size, &cfg);
+  printf("Listening on %s\n", path);
+  fflush(stdout);
+
+  while (!stopping) {
+    if ((n = epoll_wait(epfd, events, MAX_EVENTS, -1)) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+    for (i=0; i<n; i++) {
+      if (!(c = events[i].data.ptr)) {
+        accept_conns(lfd);
+      } else if (events[i].events & EPOLLOUT) {
+        write_conn(ht, c);
+      } else {
+        read_conn(ht, c);
+      }
+    }
+  }
+
+  printf("Served %lu requests in %lu batches; %lu entries\n", nrequests,
+         nbatches, ht->count);
+  close(lfd);
+  unlink(path);
+  free_hashtable(ht);
+  while ((c = free_conns)) {
+    free_conns = c->next_free;
+    free(c);
+  }
+  return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef HTSERVER_H
+#define HTSERVER_H
+
+/* Protocol of htserver. A request is a trace directive on a line of its
+   own: "p KEY VAL", "g KEY", "d KEY", "r SIZE" or "i". Each is answered,
+   in order, with one line: HTS_OK for p, d and r, HTS_VAL and the value
+   or HTS_MISS for g, the entry count for i, and HTS_ERR for anything
+   else, an r whose SIZE is not a positive number included. A line may be at most HTS_BUF_SIZE bytes, newline included. */
+
+#define HTS_SOCKET   "/tmp/htserver.sock"
+#define HTS_BUF_SIZE 65536
+
+#define HTS_OK   "ok\n"
+#define HTS_VAL  "v "
+#define HTS_MISS "-\n"
+#define HTS_ERR  "err\n"
+
+#endif
@@ -1,7 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
 #include "hashtable.h"
+#include "chashtable.h"
+#include "trace.h"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-result" 
@@ -11,92 +19,632 @@ int print_iter(char *key, void *val) {
   return 1;
 }
 
+/* The figures come from the counters ht_stats keeps, so printing them
+   does not walk the table, unless the longest chain or probe is past the
+   end of the histogram; then it is found the long way. */
+#ifdef HT_OPEN_ADDRESSING
+static unsigned long max_probe_len(hashtable_t *ht) {
+  unsigned long idx, len, max_len=0;
+  for (idx=0; idx<ht->size; idx++) {
+    if (ht->ctrl[idx] & 0x80) {
+      continue;
+    }
+    len = ht_probe_len(ht, idx);
+    if (max_len < len) {
+      max_len = len;
+    }
+  }
+  return max_len;
+}
+#elif defined(HT_COMPACT)
+static unsigned long max_probe_len(hashtable_t *ht) {
+  unsigned long ix, len, max_len=0;
+  for (ix=0; ix<ht->nentries; ix++) {
+    if (!ht->entries[ix].key) {
+      continue;
+    }
+    len = ht_probe_len(ht, ix);
+    if (max_len < len) {
+      max_len = len;
+    }
+  }
+  return max_len;
+}
+#endif
+
+#ifndef HT_CHAINED
 void print_ht_stats(hashtable_t *ht) {
+  ht_stats_t st;
+  ht_stats(ht, &st);
+  if (st.max_len == HT_HIST_LEN - 1) {
+    st.max_len = max_probe_len(ht);
+  }
+  printf("Num buckets = %lu\n", st.count);
+  printf("Max probe length = %lu\n", st.max_len);
+  printf("Avg probe length = %0.2f\n", (float)st.total_len / st.count);
+}
+#else
+static unsigned long max_chain_len(bucket_t **buckets, unsigned long size) {
   bucket_t *b;
-  unsigned long idx, len, max_len=0, num_buckets=0, num_chains=0;
-  for (idx=0; idx<ht->size; idx++) {
-    b = ht->buckets[idx];
+  unsigned long idx, len, max_len=0;
+  for (idx=0; idx<size; idx++) {
     len = 0;
-    while (b) {
+    for (b = buckets[idx]; b; b = b->next) {
       len++;
-      num_buckets++;
-      b = b->next;
-    }
-    if (len > 0) {
-      num_chains++;
     }
     if (max_len < len) {
       max_len = len;
     }
   }
-  printf("Num buckets = %lu\n", num_buckets);
-  printf("Max chain length = %lu\n", max_len);
-  printf("Avg chain length = %0.2f\n", (float)num_buckets / num_chains);
+  return max_len;
 }
 
-void eval_tracefile(char *filename) {
-  FILE *infile;
-  int ht_size;
-  char buf[80], *key, *val;
-  hashtable_t *ht;
+void print_ht_stats(hashtable_t *ht) {
+  unsigned long old_max;
+  ht_stats_t st;
+  ht_stats(ht, &st);
+  if (st.max_len == HT_HIST_LEN - 1) {
+    st.max_len = max_chain_len(ht->buckets, ht->size);
+    if (ht->old_buckets
+        && (old_max = max_chain_len(ht->old_buckets, ht->old_size)) > st.max_len) {
+      st.max_len = old_max;
+    }
+  }
+  printf("Num buckets = %lu\n", st.total_len);
+  printf("Max chain length = %lu\n", st.max_len);
+  printf("Avg chain length = %0.2f\n",
+         (float)st.total_len / (st.size - st.hist[0]));
+  if (ht->resizes) {
+    printf("Automatic resizes = %lu (table size %lu%s)\n", ht->resizes,
+           ht->size, ht->old_buckets ? ", migrating" : "");
+    printf("Max op time while migrating = %lu ns\n", ht->max_migrate_op_ns);
+  }
+  if (ht->front) {
+    printf("Front cache hits = %lu of %lu gets\n", st.front_hits,
+           st.front_hits + st.front_misses);
+  }
+}
+#endif
+
+int use_arena = 0;              /* if true, put with ht_put_str (-A) */
+int mem_report = 0;             /* if true, report malloc calls and RSS (-m) */
+char *json_file = NULL;         /* --bench results are appended here (-j) */
+
+/* mallocs made by the table itself */
+static unsigned long table_mallocs(hashtable_t *ht) {
+#ifdef HT_CHAINED
+  return ht->allocs + ht->nodes.nslabs + ht->strings.nchunks;
+#else
+  return ht->allocs;
+#endif
+}
+
+static void print_mem_report(hashtable_t *ht, unsigned long nops,
+                             unsigned long driver_mallocs) {
+  struct rusage ru;
+  unsigned long total = driver_mallocs + table_mallocs(ht);
+  getrusage(RUSAGE_SELF, &ru);
+  printf("Malloc calls = %lu (%lu by driver, %lu by table)\n",
+         total, driver_mallocs, table_mallocs(ht));
+  printf("Malloc calls per op = %0.3f\n", (double)total / nops);
+  printf("Peak RSS = %ld KiB\n", ru.ru_maxrss);
+}
 
-  if ((infile = fopen(filename, "r")) == NULL) {
+static void print_cache_stats(hashtable_t *ht) {
+  ht_cache_stats_t cs;
+  ht_cache_stats(ht, &cs);
+  printf("Cache capacity = %lu, entries = %lu\n", cs.capacity, cs.count);
+  printf("Cache hits = %lu, misses = %lu, evictions = %lu\n",
+         cs.hits, cs.misses, cs.evictions);
+}
+
+static double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static trace_t *open_trace(char *filename) {
+  trace_t *t = load_trace(filename);
+  if (!t) {
     printf("Error opening tracefile %s\n", filename);
     exit(1);
   }
+  return t;
+}
 
-  fscanf(infile, "%d", &ht_size);
-  printf("Creating hashtable of size %d\n", ht_size);
-  ht = make_hashtable(ht_size);
+void eval_tracefile(char *filename, const ht_config_t *cfg) {
+  trace_t *t = open_trace(filename);
+  unsigned long i, mallocs = 0;
+  trace_op_t *op;
+  hashtable_t *ht;
+  char *val;
+
+  printf("Creating hashtable of size %lu\n", t->size);
+  ht = make_hashtable_cfg(t->size, cfg);
 
-  while (fscanf(infile, "%s", buf) != EOF) {
-    switch(buf[0]) {
+  for (i=0; i<t->nops; i++) {
+    op = &t->ops[i];
+    switch(op->type) {
     case 'p':
-      fscanf(infile, "%s", buf);
-      key = strdup(buf);
-      fscanf(infile, "%s", buf);
-      val = strdup(buf);
-      printf("Inserting %s => %s\n", key, val);
-      ht_put(ht, key, val);
+      printf("Inserting %s => %s\n", op->key, op->val);
+      if (use_arena) {
+        ht_put_str(ht, op->key, op->val);
+      } else {
+        mallocs += 2;
+        ht_put(ht, strdup(op->key), strdup(op->val));
+      }
       break;
     case 'g':
-      fscanf(infile, "%s", buf);
-      printf("Looking up key %s\n", buf);
-      if ((val = ht_get(ht, buf))) {
+      printf("Looking up key %s\n", op->key);
+      if ((val = ht_get(ht, op->key))) {
         printf("Found value %s\n", val);
       } else {
         printf("Key not found\n");
       }
       break;
     case 'd':
-      fscanf(infile, "%s", buf);
-      printf("Removing key %s\n", buf);
-      ht_del(ht, buf);
+      printf("Removing key %s\n", op->key);
+      ht_del(ht, op->key);
       break;
     case 'r':
-      fscanf(infile, "%d", &ht_size);
-      printf("Rehashing to %d buckets\n", ht_size);
-      ht_rehash(ht, ht_size);
+      printf("Rehashing to %lu buckets\n", op->n);
+      ht_rehash(ht, op->n);
       break;
     case 'i':
       printf("Printing hashtable info\n");
       print_ht_stats(ht);
       break;
     default:
-      printf("Bad tracefile directive (%c)", buf[0]);
+      printf("Bad tracefile directive (%c)", op->type);
       exit(1);
     }
   }
+  if (mem_report) {
+    print_mem_report(ht, t->nops, mallocs);
+  }
+  if (cfg->capacity) {
+    print_cache_stats(ht);
+  }
   free_hashtable(ht);
-  fclose(infile);
+  free_trace(t);
+}
+
+
+static unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+#define BENCH_MIN_OPS 1000000UL
+
+static const char *const dir_names = "pgdr";
+
+/* Op latencies are binned in a log-linear histogram: exact below LAT_SUB
+   ns, then LAT_SUB bins per power of two, so a percentile read from it
+   is within 1/LAT_SUB of the true value. */
+#define LAT_SUB   16
+#define LAT_BINS  (61 * LAT_SUB)
+
+struct dir_stats {
+  unsigned long ns, count;
+  unsigned long hist[LAT_BINS];
+};
+
+static unsigned int lat_bin(unsigned long ns) {
+  int e;
+  if (ns < LAT_SUB) {
+    return ns;
+  }
+  e = 63 - __builtin_clzl(ns);  /* 2^e <= ns < 2^(e+1), e >= 4 */
+  return (e - 3) * LAT_SUB + ((ns >> (e - 4)) & (LAT_SUB - 1));
+}
+
+/* lower bound of the bin holding the p'th fraction of ops */
+static unsigned long percentile(struct dir_stats *st, double p) {
+  unsigned long want = (unsigned long)(st->count * p), seen = 0, i;
+  for (i=0; i<LAT_BINS; i++) {
+    seen += st->hist[i];
+    if (seen > want) {
+      break;
+    }
+  }
+  if (i < LAT_SUB) {
+    return i;
+  }
+  return (LAT_SUB + i % LAT_SUB) << (i / LAT_SUB - 1);
+}
+
+/* heap bytes in use, counting large blocks that malloc mmaps itself */
+static size_t heap_bytes(void) {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+/* Replays the trace with no output. If st is given, each op is timed and
+   counted in st under its directive's index in dir_names; otherwise
+   nothing is timed. Returns mallocs made. */
+static unsigned long replay(hashtable_t *ht, trace_t *t,
+                            struct dir_stats *st) {
+  unsigned long i, t0 = 0, mallocs = 0;
+  trace_op_t *op;
+  const char *d;
+
+  for (i=0; i<t->nops; i++) {
+    op = &t->ops[i];
+    if (st) {
+      t0 = now_ns();
+    }
+    switch(op->type) {
+    case 'p':
+      if (use_arena) {
+        ht_put_str(ht, op->key, op->val);
+      } else {
+        mallocs += 2;
+        ht_put(ht, strdup(op->key), strdup(op->val));
+      }
+      break;
+    case 'g':
+      ht_get(ht, op->key);
+      break;
+    case 'd':
+      ht_del(ht, op->key);
+      break;
+    case 'r':
+      ht_rehash(ht, op->n);
+      break;
+    case 'i':
+      continue;
+    default:
+      printf("Bad tracefile directive (%c)", op->type);
+      exit(1);
+    }
+    if (st) {
+      t0 = now_ns() - t0;
+      d = strchr(dir_names, op->type);
+      st[d - dir_names].ns += t0;
+      st[d - dir_names].count++;
+      st[d - dir_names].hist[lat_bin(t0)]++;
+    }
+  }
+  return mallocs;
+}
+
+static const char *hash_name(const ht_config_t *cfg) {
+  const ht_hashfn_info_t *h;
+  for (h = ht_hashfns; h->name; h++) {
+    if (h->fn == cfg->hashfn) {
+      return h->name;
+    }
+  }
+  return cfg->hashfn ? "?" : "sip";
+}
+
+/* one JSON object per run, appended to json_file, for tracking results
+   across builds */
+static void write_json(char *filename, const ht_config_t *cfg,
+                       unsigned long nops, unsigned long passes, double secs,
+                       struct dir_stats *st, unsigned long entries,
+                       double bytes_per_entry, double scan_ms, long rss_kib) {
+  FILE *f = fopen(json_file, "a");
+  int i, first = 1;
+
+  if (!f) {
+    perror(json_file);
+    return;
+  }
+  fprintf(f, "{\"time\": %ld, \"trace\": \"%s\", ", (long)time(NULL),
+          filename);
+#if defined(HT_OPEN_ADDRESSING)
+  fprintf(f, "\"table\": \"open-addressing\", ");
+#elif defined(HT_COMPACT)
+  fprintf(f, "\"table\": \"compact\", ");
+#else
+  fprintf(f, "\"table\": \"chained\", ");
+#endif
+  fprintf(f, "\"hash\": \"%s\", \"arena\": %d, \"auto_resize\": %d, ",
+          hash_name(cfg), use_arena, cfg->max_load > 0);
+  fprintf(f, "\"ops\": %lu, \"passes\": %lu, \"ops_per_sec\": %.0f, ",
+          nops, passes, nops * passes / secs);
+  fprintf(f, "\"entries\": %lu, \"bytes_per_entry\": %.1f, "
+          "\"scan_ms\": %.3f, \"peak_rss_kib\": %ld, \"directives\": {",
+          entries, bytes_per_entry, scan_ms, rss_kib);
+  for (i=0; dir_names[i]; i++) {
+    if (st[i].count) {
+      fprintf(f, "%s\"%c\": {\"count\": %lu, \"ns_per_op\": %.1f, "
+              "\"p50\": %lu, \"p99\": %lu, \"p999\": %lu}",
+              first ? "" : ", ", dir_names[i], st[i].count / passes,
+              (double)st[i].ns / st[i].count, percentile(&st[i], 0.5),
+              percentile(&st[i], 0.99), percentile(&st[i], 0.999));
+      first = 0;
+    }
+  }
+  fprintf(f, "}}\n");
+  fclose(f);
+}
+
+/* -q/--bench: replays the trace silently, on a fresh table per pass and
+   for at least BENCH_MIN_OPS ops in all, first untimed for throughput
+   and memory, then again timing every op for a per-directive breakdown */
+static unsigned long scan_count;
+
+static int count_entry(char *key, void *val) {
+  scan_count++;
+  return 1;
+}
+
+/* ms for one ht_iter over the whole table, the best of a few */
+static double time_scan(hashtable_t *ht) {
+  double best = 0, t0;
+  int i;
+  for (i=0; i<5; i++) {
+    t0 = now_secs();
+    ht_iter(ht, count_entry);
+    t0 = now_secs() - t0;
+    if (i == 0 || t0 < best) {
+      best = t0;
+    }
+  }
+  return best * 1e3;
+}
+
+void eval_bench(char *filename, const ht_config_t *cfg) {
+  trace_t *t = open_trace(filename);
+  struct dir_stats *st = calloc(strlen(dir_names), sizeof(struct dir_stats));
+  unsigned long pass, passes, mallocs = 0, entries = 0;
+  double secs = 0, t0, per_entry = 0, scan_ms = 0;
+  struct rusage ru;
+  hashtable_t *ht;
+  size_t heap;
+  int i;
+
+  passes = BENCH_MIN_OPS / (t->nops ? t->nops : 1) + 1;
+  for (pass=0; pass<passes; pass++) {
+    heap = heap_bytes();
+    ht = make_hashtable_cfg(t->size, cfg);
+    t0 = now_secs();
+    mallocs += replay(ht, t, NULL);
+    secs += now_secs() - t0;
+    if (pass == passes - 1) {
+      /* everything the table holds, its keys and values included */
+      entries = ht->count;
+      per_entry = entries ? (double)(heap_bytes() - heap) / entries : 0;
+      scan_ms = time_scan(ht);
+      if (mem_report) {
+        print_mem_report(ht, t->nops, mallocs / passes);
+      }
+      if (cfg->capacity) {
+        print_cache_stats(ht);
+      }
+    }
+    free_hashtable(ht);
+  }
+  printf("Replayed %lu ops x %lu passes in %0.3f s: %0.0f ops/sec\n",
+         t->nops, passes, secs, t->nops * passes / secs);
+
+  for (pass=0; pass<passes; pass++) {
+    ht = make_hashtable_cfg(t->size, cfg);
+    replay(ht, t, st);
+    free_hashtable(ht);
+  }
+  printf("%-10s %12s %12s %10s %8s %8s %8s\n", "directive", "count",
+         "total ms", "ns/op", "p50", "p99", "p999");
+  for (i=0; dir_names[i]; i++) {
+    if (st[i].count) {
+      printf("%-10c %12lu %12.2f %10.1f %8lu %8lu %8lu\n", dir_names[i],
+             st[i].count / passes, st[i].ns / 1e6 / passes,
+             (double)st[i].ns / st[i].count, percentile(&st[i], 0.5),
+             percentile(&st[i], 0.99), percentile(&st[i], 0.999));
+    }
+  }
+  getrusage(RUSAGE_SELF, &ru);
+  printf("%lu entries at %0.1f bytes each, peak RSS %ld KiB\n", entries,
+         per_entry, ru.ru_maxrss);
+  printf("Full scan in %0.3f ms (%0.1f ns per entry)\n", scan_ms,
+         entries ? scan_ms * 1e6 / entries : 0);
+  if (json_file) {
+    write_json(filename, cfg, t->nops, passes, secs, st, entries, per_entry,
+               scan_ms, ru.ru_maxrss);
+  }
+  free(st);
+  free_trace(t);
+}
+
+struct worker {
+  chashtable_t *ht;
+  trace_op_t *ops;
+  unsigned long lo, hi, passes;
+};
+
+static void *replay_worker(void *arg) {
+  struct worker *w = arg;
+  unsigned long pass, i;
+  trace_op_t *op;
+
+  for (pass=0; pass<w->passes; pass++) {
+    for (i=w->lo; i<w->hi; i++) {
+      op = &w->ops[i];
+      switch (op->type) {
+      case 'p':
+        cht_put(w->ht, strdup(op->key), strdup(op->val));
+        break;
+      case 'g':
+        cht_read_lock();
+        cht_get(w->ht, op->key);
+        cht_read_unlock();
+        break;
+      case 'd':
+        cht_del(w->ht, op->key);
+        break;
+      case 'r':
+        cht_resize(w->ht, op->n);
+        break;
+      }
+    }
+  }
+  cht_synchronize();
+  return NULL;
+}
+
+#define REPLAY_STRIPES 64
+#define REPLAY_MIN_OPS 2000000UL
+
+/* Replays the trace against a shared chashtable_t, split into contiguous
+   slices across 1, 2, 4, ... up to maxthreads threads, reporting the
+   throughput at each thread count. */
+void eval_threaded(char *filename, int maxthreads) {
+  trace_t *tr = open_trace(filename);
+  unsigned long nops = tr->nops, passes, total;
+  struct worker *w = malloc(sizeof(struct worker) * maxthreads);
+  pthread_t *tids = malloc(sizeof(pthread_t) * maxthreads);
+  double t, base = 0;
+  int n, i;
+
+  passes = REPLAY_MIN_OPS / (nops ? nops : 1) + 1;
+  total = passes * nops;
+  printf("Replaying %lu ops x %lu passes (%ld CPUs online)\n",
+         nops, passes, sysconf(_SC_NPROCESSORS_ONLN));
+  for (n=1; ; n = n * 2 > maxthreads && n < maxthreads ? maxthreads : n * 2) {
+    chashtable_t *ht = make_chashtable(tr->size, REPLAY_STRIPES);
+    t = now_secs();
+    for (i=0; i<n; i++) {
+      w[i].ht = ht;
+      w[i].ops = tr->ops;
+      w[i].lo = nops * i / n;
+      w[i].hi = nops * (i + 1) / n;
+      w[i].passes = passes;
+      pthread_create(&tids[i], NULL, replay_worker, &w[i]);
+    }
+    for (i=0; i<n; i++) {
+      pthread_join(tids[i], NULL);
+    }
+    t = now_secs() - t;
+    if (n == 1) {
+      base = total / t;
+    }
+    printf("%3d thread(s): %12.0f ops/sec  %5.2fx  (%lu entries)\n",
+           n, total / t, total / t / base, cht_count(ht));
+    free_chashtable(ht);
+    if (n >= maxthreads) {
+      break;
+    }
+  }
+  free(tids);
+  free(w);
+  free_trace(tr);
+}
+
+static void usage(char *prog) {
+  const ht_hashfn_info_t *h;
+  printf("Usage: %s [-aAmqT] [-b BITS] [-c N] [-F SLOTS] [-H HASH] [-j FILE] "
+         "[-t THREADS] "
+         "TRACEFILE_NAME\n", prog);
+  printf("  -a       grow and shrink the table automatically with its load\n");
+  printf("  -A       let the table copy keys and values into its own arena\n");
+  printf("  -m       report malloc calls and peak RSS at the end\n");
+  printf("  -T       index long chains with balanced trees\n");
+  printf("  -b BITS  test a Bloom filter of BITS counters per bucket before\n"
+         "           walking a chain\n");
+  printf("  -c N     run the table as an LRU cache of at most N entries\n");
+  printf("  -F SLOTS check a cache of SLOTS recently read entries before\n"
+         "           hashing a key to get\n");
+  printf("  -q, --bench\n");
+  printf("           replay silently, reporting ops/sec, time per directive,\n");
+  printf("           latency percentiles (ns) and memory per entry\n");
+  printf("  -j FILE, --json FILE\n");
+  printf("           with --bench, append the results to FILE as a JSON line\n");
+  printf("  -H HASH  hash function, one of:");
+  for (h = ht_hashfns; h->name; h++) {
+    printf(" %s", h->name);
+  }
+  printf("\n           (default sip, seeded for each table; djb, unseeded, gives\n"
+         "           the reference outputs)\n");
+  printf("  -t N     replay silently on a thread-safe table with 1..N threads\n");
+  exit(0);
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s TRACEFILE_NAME\n", argv[0]);
-    exit(0);
+  static struct option longopts[] = {
+    { "bench", no_argument, NULL, 'q' },
+    { "json", required_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+  };
+  ht_config_t cfg = { 0 };
+  int opt, threads = 0, bench = 0;
+
+  while ((opt = getopt_long(argc, argv, "aAmqTb:c:F:H:j:t:", longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'a':
+      cfg.max_load = 1.0;
+      cfg.min_load = 0.125;
+      break;
+    case 'A':
+      use_arena = 1;
+      break;
+    case 'm':
+      mem_report = 1;
+      break;
+    case 'q':
+      bench = 1;
+      break;
+    case 'T':
+      cfg.tree_bins = 1;
+      break;
+    case 'b':
+#ifndef HT_CHAINED
+      printf("Only the chained table has a Bloom filter\n");
+      exit(1);
+#endif
+      if (!(cfg.bloom_bits = strtoul(optarg, NULL, 10))) {
+        usage(argv[0]);
+      }
+      break;
+    case 'c':
+#ifndef HT_CHAINED
+      printf("Only the chained table has a cache mode\n");
+      exit(1);
+#endif
+      if (!(cfg.capacity = strtoul(optarg, NULL, 10))) {
+        usage(argv[0]);
+      }
+      break;
+    case 'F':
+#ifndef HT_CHAINED
+      printf("Only the chained table has a front cache\n");
+      exit(1);
+#endif
+      if (!(cfg.front_slots = strtoul(optarg, NULL, 10))) {
+        usage(argv[0]);
+      }
+      break;
+    case 'H':
+      if (!(cfg.hashfn = ht_hashfn_by_name(optarg))) {
+        usage(argv[0]);
+      }
+      break;
+    case 'j':
+      json_file = optarg;
+      break;
+    case 't':
+      if ((threads = atoi(optarg)) < 1) {
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+  }
+  if (threads) {
+    eval_threaded(argv[optind], threads);
+  } else if (bench) {
+    eval_bench(argv[optind], &cfg);
+  } else {
+    eval_tracefile(argv[optind], &cfg);
   }
-  eval_tracefile(argv[1]);
   return 0;
 }
 
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "hashtable.h"
+
+/* Checks ht_scan's promise against whichever backend it is linked with:
+   the table grows eightfold between slices, with deletes and resizes
+   both ways mixed in, and any key there for the whole scan that was not
+   seen is a failure. An argument seeds random() and the hash. */
+
+#define NKEYS 1000
+
+static char seen[NKEYS], gone[NKEYS];
+
+static void scan_entry(char *key, void *val) {
+  if (key[0] == 'k')
+    seen[atoi(key + 1)] = 1;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long cursor = 0, slices = 0, added = 0, missed = 0, size, top, n;
+  char key[32];
+  ht_config_t cfg = { 0 };
+  hashtable_t *ht;
+  ht_stats_t st;
+  int i;
+
+  cfg.seed = argc > 1 ? strtoul(argv[1], NULL, 10) : 1013;
+  srandom(cfg.seed);
+  cfg.max_load = 1.0;           /* the chained table only grows if asked */
+  ht = make_hashtable_cfg(16, &cfg);
+  for (i=0; i<NKEYS; i++) {
+    sprintf(key, "k%d", i);
+    ht_put_str(ht, key, "v");
+  }
+  ht_stats(ht, &st);
+  size = top = st.size;
+  do {
+    cursor = ht_scan(ht, cursor, 1, scan_entry);
+    slices++;
+    /* new keys to grow the table eightfold over the first part of the
+       scan, and deletes, which leave tombstones or holes to sweep up */
+    for (i=0; i<16 && added < 8 * NKEYS; i++) {
+      sprintf(key, "n%lu", added++);
+      ht_put_str(ht, key, "v");
+    }
+    for (i=0; i<4; i++) {
+      sprintf(key, "n%lu", random() % added);
+      ht_del(ht, key);
+    }
+    if (slices % 16 == 0) {
+      /* and resizes of its own, down as well as up, to a power of two */
+      ht_stats(ht, &st);
+      if (st.size > top)
+        top = st.size;
+      for (n = 16; n < st.count; n <<= 1)
+        ;
+      ht_rehash(ht, slices % 32 ? n : n * 4);
+    }
+    i = random() % NKEYS;
+    sprintf(key, "k%d", i);
+    ht_del(ht, key);
+    gone[i] = 1;
+  } while (cursor);
+
+  for (i=0; i<NKEYS; i++) {
+    if (!gone[i] && !seen[i]) {
+      printf("k%d missed\n", i);
+      missed++;
+    }
+  }
+  printf("%lu slices, size %lu grown to %lu, %lu keys missed\n", slices,
+         size, top, missed);
+  free_hashtable(ht);
+  return missed != 0 || top <= size;
+}
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+#define SLAB_BYTES  (64 * 1024)
+#define CHUNK_BYTES (64 * 1024)
+#define ALIGN       sizeof(void *)
+
+static unsigned long align_up(unsigned long n) {
+  return (n + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+void slab_init(slab_pool_t *pool, unsigned long objsize) {
+  memset(pool, 0, sizeof(slab_pool_t));
+  pool->objsize = align_up(objsize < sizeof(void *) ? sizeof(void *) : objsize);
+}
+
+void *slab_alloc(slab_pool_t *pool) {
+  void *obj;
+  char *slab;
+
+  if ((obj = pool->free)) {
+    pool->free = *(void **)obj;
+    return obj;
+  }
+  if (pool->next + pool->objsize > pool->end) {
+    slab = malloc(SLAB_BYTES);
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+    pool->nslabs++;
+    pool->next = slab + align_up(sizeof(void *));
+    pool->end = slab + SLAB_BYTES;
+  }
+  obj = pool->next;
+  pool->next += pool->objsize;
+  return obj;
+}
+
+void slab_free(slab_pool_t *pool, void *obj) {
+  *(void **)obj = pool->free;
+  pool->free = obj;
+}
+
+unsigned long slab_bytes(const slab_pool_t *pool) {
+  return pool->nslabs * SLAB_BYTES;
+}
+
+void slab_destroy(slab_pool_t *pool) {
+  void *slab, *next;
+  for (slab = pool->slabs; slab; slab = next) {
+    next = *(void **)slab;
+    free(slab);
+  }
+  slab_init(pool, pool->objsize);
+}
+
+void arena_init(arena_t *a) {
+  memset(a, 0, sizeof(arena_t));
+}
+
+/* strings too big to share a chunk get a chunk of their own, linked in
+   behind the current one so its free tail stays in use */
+char *arena_strdup(arena_t *a, const char *s, unsigned long len) {
+  unsigned long need = len + 1, hdr = align_up(sizeof(void *));
+  char *chunk, *p;
+
+  if (a->next + need > a->end) {
+    if (need > CHUNK_BYTES / 4) {
+      chunk = malloc(hdr + need);
+      if (a->chunks) {
+        *(void **)chunk = *(void **)a->chunks;
+        *(void **)a->chunks = chunk;
+      } else {
+        *(void **)chunk = NULL;
+        a->chunks = chunk;
+      }
+      a->nchunks++;
+      a->held += hdr + need;
+      a->bytes += need;
+      p = chunk + hdr;
+      memcpy(p, s, len);
+      p[len] = '\0';
+      return p;
+    }
+    chunk = malloc(CHUNK_BYTES);
+    *(void **)chunk = a->chunks;
+    a->chunks = chunk;
+    a->nchunks++;
+    a->held += CHUNK_BYTES;
+    a->next = chunk + hdr;
+    a->end = chunk + CHUNK_BYTES;
+  }
+  p = a->next;
+  a->next += need;
+  a->bytes += need;
+  memcpy(p, s, len);
+  p[len] = '\0';
+  return p;
+}
+
+void arena_destroy(arena_t *a) {
+  void *chunk, *next;
+  for (chunk = a->chunks; chunk; chunk = next) {
+    next = *(void **)chunk;
+    free(chunk);
+  }
+  arena_init(a);
+}
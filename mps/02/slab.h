@@ -0,0 +1,35 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+/* Fixed-size object pool: objects are carved out of large slabs and
+   recycled through a free list, and slab_destroy releases everything at
+   once, one free per slab. */
+typedef struct slab_pool {
+  unsigned long objsize;
+  void *free;                   /* recycled objects, linked through themselves */
+  char *next, *end;             /* unused tail of the newest slab */
+  void *slabs;                  /* every slab, linked through its first word */
+  unsigned long nslabs;
+} slab_pool_t;
+
+void  slab_init(slab_pool_t *pool, unsigned long objsize);
+void *slab_alloc(slab_pool_t *pool);
+void  slab_free(slab_pool_t *pool, void *obj);
+unsigned long slab_bytes(const slab_pool_t *pool);    /* malloc'd */
+void  slab_destroy(slab_pool_t *pool);
+
+/* Bump allocator for strings that live as long as their arena. Nothing is
+   freed individually; arena_destroy releases all chunks. */
+typedef struct arena {
+  char *next, *end;
+  void *chunks;                 /* linked through their first word */
+  unsigned long nchunks;
+  unsigned long bytes;          /* bytes handed out */
+  unsigned long held;           /* bytes malloc'd for chunks */
+} arena_t;
+
+void  arena_init(arena_t *a);
+char *arena_strdup(arena_t *a, const char *s, unsigned long len);
+void  arena_destroy(arena_t *a);
+
+#endif
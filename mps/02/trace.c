@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* The file is mapped private and writable, so writing the terminating
+   NULs only copies the pages touched. Past EOF the last page reads as
+   zeros, which terminates a final token with no trailing newline, unless
+   the file ends exactly on a page boundary; such files are read into a
+   buffer one byte longer instead. */
+static int map_file(trace_t *t, const char *filename) {
+  struct stat st;
+  int fd;
+  long page = sysconf(_SC_PAGESIZE);
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  t->len = st.st_size;
+  if (t->len > 0 && t->len % page != 0) {
+    t->buf = mmap(NULL, t->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (t->buf != MAP_FAILED) {
+      madvise(t->buf, t->len, MADV_SEQUENTIAL);
+      t->mapped = 1;
+      close(fd);
+      return 0;
+    }
+  }
+  t->buf = malloc(t->len + 1);
+  if (t->len > 0 && read(fd, t->buf, t->len) != (ssize_t)t->len) {
+    free(t->buf);
+    close(fd);
+    return -1;
+  }
+  t->buf[t->len] = '\0';
+  close(fd);
+  return 0;
+}
+
+static inline int is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+/* next whitespace-delimited token at *p, NUL-terminated in place */
+static char *token(char **p, char *end) {
+  char *s = *p, *tok;
+  while (s < end && is_space(*s))
+    s++;
+  if (s >= end || *s == '\0')
+    return NULL;
+  tok = s;
+  while (s < end && *s && !is_space(*s))
+    s++;
+  if (s < end)
+    *s++ = '\0';
+  *p = s;
+  return tok;
+}
+
+trace_t *load_trace(const char *filename) {
+  trace_t *t = calloc(1, sizeof(trace_t));
+  char *p, *end, *tok;
+  unsigned long cap;
+  trace_op_t *op;
+
+  if (map_file(t, filename) < 0) {
+    free(t);
+    return NULL;
+  }
+  p = t->buf;
+  end = t->buf + t->len;
+  if ((tok = token(&p, end)))
+    t->size = strtoul(tok, NULL, 10);
+
+  /* a directive takes at least 2 bytes, which bounds the op count */
+  cap = t->len / 2 + 1;
+  t->ops = malloc(sizeof(trace_op_t) * cap);
+  while ((tok = token(&p, end))) {
+    op = &t->ops[t->nops];
+    memset(op, 0, sizeof(trace_op_t));
+    op->type = tok[0];
+    switch (op->type) {
+    case 'p':
+      op->key = token(&p, end);
+      op->val = token(&p, end);
+      if (!op->val)
+        goto done;
+      break;
+    case 'g':
+    case 'd':
+      if (!(op->key = token(&p, end)))
+        goto done;
+      break;
+    case 'r':
+      if (!(tok = token(&p, end)))
+        goto done;
+      op->n = strtoul(tok, NULL, 10);
+      break;
+    case 'i':
+      break;
+    default:
+      t->nops++;
+      goto done;
+    }
+    t->nops++;
+  }
+ done:
+  t->ops = realloc(t->ops, sizeof(trace_op_t) * (t->nops ? t->nops : 1));
+  return t;
+}
+
+void free_trace(trace_t *t) {
+  if (t->mapped)
+    munmap(t->buf, t->len);
+  else
+    free(t->buf);
+  free(t->ops);
+  free(t);
+}
@@ -0,0 +1,28 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* A tracefile decoded up front into an array of directives. Keys and
+   values point into the file's own bytes, NUL-terminated in place. */
+
+typedef struct trace_op {
+  char type;                    /* directive letter: p, g, d, r, i, ... */
+  char *key, *val;
+  unsigned long n;              /* bucket count for r */
+} trace_op_t;
+
+typedef struct trace {
+  unsigned long size;           /* initial table size */
+  trace_op_t *ops;
+  unsigned long nops;
+  char *buf;                    /* the file's bytes */
+  unsigned long len;
+  int mapped;                   /* buf is mmap'd rather than malloc'd */
+} trace_t;
+
+/* returns NULL if the file cannot be read; decoding stops at the first
+   unknown directive, which is kept as the last op for the caller to
+   report */
+trace_t *load_trace(const char *filename);
+void     free_trace(trace_t *t);
+
+#endif
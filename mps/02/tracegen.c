@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+/* Writes a synthetic tracefile to stdout, in the driver's format: the
+   table size, then (unless -F) one put of every key, then OPS directives
+   drawn from the get:put:delete mix, on keys drawn from DIST. */
+
+enum { UNIFORM, ZIPF, SEQ, ADVERSARIAL };
+
+static const char *const dist_names[] = {
+  "uniform", "zipf", "seq", "adversarial", NULL
+};
+
+static unsigned long rng_state;
+
+/* splitmix64 */
+static unsigned long rng(void) {
+  unsigned long z = (rng_state += 0x9e3779b97f4a7c15UL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+  return z ^ (z >> 31);
+}
+
+static double rng_unit(void) {
+  return (rng() >> 11) * (1.0 / (1UL << 53));
+}
+
+/* cumulative probabilities of ranks 0..n-1 under Zipf(theta) */
+static double *zipf_cdf(unsigned long n, double theta) {
+  double *cdf = malloc(sizeof(double) * n), sum = 0;
+  unsigned long i;
+
+  for (i=0; i<n; i++) {
+    sum += 1.0 / pow(i + 1, theta);
+    cdf[i] = sum;
+  }
+  for (i=0; i<n; i++) {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+static unsigned long zipf_rank(double *cdf, unsigned long n) {
+  double u = rng_unit();
+  unsigned long lo = 0, hi = n - 1, mid;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* "Ez" and "FY" have the same DJB hash, and so does every string made of
+   the same number of such blocks: key i picks a block per bit of i, so
+   all the keys land in one bucket whatever the table size */
+static char *adversarial_key(char *buf, unsigned long i, int blocks) {
+  int b;
+  for (b=0; b<blocks; b++) {
+    memcpy(buf + 2 * b, (i >> b) & 1 ? "FY" : "Ez", 2);
+  }
+  buf[2 * blocks] = '\0';
+  return buf;
+}
+
+static void usage(char *prog) {
+  int i;
+  printf("Usage: %s [-F] [-d DIST] [-n OPS] [-k KEYS] [-m G:P:D] [-z THETA]\n"
+         "       [-s SIZE] [-S SEED]\n", prog);
+  printf("  -d DIST   key distribution, one of:");
+  for (i=0; dist_names[i]; i++) {
+    printf(" %s", dist_names[i]);
+  }
+  printf("\n");
+  printf("  -n OPS    directives after the initial fill (default 1000000)\n");
+  printf("  -k KEYS   distinct keys (default 100000)\n");
+  printf("  -m G:P:D  relative weights of gets, puts and deletes (90:9:1)\n");
+  printf("  -z THETA  skew of the zipf distribution (0.99)\n");
+  printf("  -s SIZE   initial table size (default KEYS)\n");
+  printf("  -S SEED   random seed (351)\n");
+  printf("  -F        skip the initial put of every key\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long ops = 1000000, nkeys = 100000, size = 0, i, k, r, w;
+  unsigned long mix[3] = { 90, 9, 1 };
+  double theta = 0.99, *cdf = NULL;
+  int dist = UNIFORM, fill = 1, blocks = 1, opt;
+  char buf[160], *key, op;
+
+  rng_state = 351;
+  while ((opt = getopt(argc, argv, "Fd:n:k:m:z:s:S:")) != -1) {
+    switch (opt) {
+    case 'F':
+      fill = 0;
+      break;
+    case 'd':
+      for (dist=0; dist_names[dist] && strcmp(dist_names[dist], optarg); dist++)
+        ;
+      if (!dist_names[dist]) {
+        usage(argv[0]);
+      }
+      break;
+    case 'n':
+      ops = strtoul(optarg, NULL, 10);
+      break;
+    case 'k':
+      nkeys = strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      if (sscanf(optarg, "%lu:%lu:%lu", &mix[0], &mix[1], &mix[2]) != 3
+          || mix[0] + mix[1] + mix[2] == 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 'z':
+      theta = atof(optarg);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    case 'S':
+      rng_state = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (nkeys == 0 || optind != argc) {
+    usage(argv[0]);
+  }
+  if (dist == ZIPF) {
+    cdf = zipf_cdf(nkeys, theta);
+  }
+  while (blocks < 64 && (1UL << blocks) < nkeys) {
+    blocks++;
+  }
+  w = mix[0] + mix[1] + mix[2];
+
+  printf("%lu\n", size ? size : nkeys);
+  for (i=0; i < (fill ? nkeys + ops : ops); i++) {
+    if (fill && i < nkeys) {
+      k = i;
+      op = 'p';
+    } else {
+      switch (dist) {
+      case ZIPF:
+        k = zipf_rank(cdf, nkeys);
+        break;
+      case SEQ:
+        k = i % nkeys;
+        break;
+      default:
+        k = rng() % nkeys;
+      }
+      r = rng() % w;
+      op = r < mix[0] ? 'g' : r < mix[0] + mix[1] ? 'p' : 'd';
+    }
+    if (dist == ADVERSARIAL) {
+      key = adversarial_key(buf, k, blocks);
+    } else {
+      sprintf(buf, "k%lu", k);
+      key = buf;
+    }
+    if (op == 'p') {
+      printf("p %s v%lu\n", key, i);
+    } else {
+      printf("%c %s\n", op, key);
+    }
+  }
+  free(cdf);
+  return 0;
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hashtable.h"
+
+/* Checks that ht_get_or_insert treats an expired entry as a new one: it
+   comes back empty, counts as a put miss and an expiration, and goes to
+   the front of the recency list, so the next eviction takes another. */
+
+static int failed;
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    printf("%s: failed\n", what);
+    failed = 1;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ht_config_t cfg = { 0 };
+  ht_stats_t before, after;
+  ht_cache_stats_t cs;
+  hashtable_t *ht;
+  void **slot;
+
+  cfg.capacity = 2;
+  ht = make_hashtable_cfg(16, &cfg);
+  ht_put_ttl(ht, strdup("a"), strdup("1"), 1);
+  ht_put(ht, strdup("b"), strdup("2"));
+  usleep(5000);
+
+  ht_stats(ht, &before);
+  slot = ht_get_or_insert(ht, "a");
+  ht_stats(ht, &after);
+  check(*slot == NULL, "expired value cleared");
+  check(after.put_misses == before.put_misses + 1 &&
+        after.put_hits == before.put_hits, "counted as a put miss");
+  check(after.count == 2, "count unchanged");
+  *slot = strdup("3");
+
+  ht_put(ht, strdup("c"), strdup("4"));
+  ht_cache_stats(ht, &cs);
+  check(cs.expirations == 1, "one expiration");
+  check(cs.evictions == 1 && !ht_get(ht, "b"), "b evicted");
+  check(ht_get(ht, "a") && strcmp(ht_get(ht, "a"), "3") == 0, "a kept");
+
+  ht_stats(ht, &before);
+  slot = ht_get_or_insert(ht, "a");
+  ht_stats(ht, &after);
+  check(*slot && strcmp(*slot, "3") == 0, "live value kept");
+  check(after.put_hits == before.put_hits + 1, "live key a put hit");
+
+  free_hashtable(ht);
+  if (!failed)
+    printf("ttl: ok\n");
+  return failed;
+}
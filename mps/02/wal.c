@@ -0,0 +1,309 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wal.h"
+
+/* The file is a run of groups, each a header and then its records. A
+   record is its key and value lengths, then the key and the value, each
+   NUL-terminated so recovery can use them where they lie in the mapped
+   file; a delete has no value. Nothing is aligned, so headers are read
+   by memcpy. The checksum covers a group's records, so
+   a group torn by a crash is found and dropped whole. */
+
+#define WAL_MAGIC 0x4c574854    /* "HTWL" */
+#define WAL_SEED  0x77616cUL    /* for the checksum */
+#define WAL_DEL   0xffffffffU   /* vlen of a delete */
+
+struct wal_group {
+  uint32_t magic;
+  uint32_t nrec;
+  uint64_t len;                 /* bytes of records after the header */
+  uint64_t sum;                 /* hash_wy of those bytes */
+};
+
+struct wal_rec {
+  uint32_t klen, vlen;
+};
+
+#define HDR sizeof(struct wal_group)
+
+static void *flusher(void *arg);
+
+wal_t *wal_open(const char *path, const wal_config_t *cfg) {
+  wal_t *w = calloc(1, sizeof(wal_t));
+
+  if ((w->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+    free(w);
+    return NULL;
+  }
+  if (cfg)
+    w->cfg = *cfg;
+  w->cap = w->spare_cap = 4096;
+  w->buf = malloc(w->cap);
+  w->spare = malloc(w->spare_cap);
+  w->len = HDR;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_mutex_init(&w->commit_lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+  if (w->cfg.flush_ms)
+    pthread_create(&w->flusher, NULL, flusher, w);
+  return w;
+}
+
+static int write_all(int fd, const char *p, unsigned long n) {
+  ssize_t r;
+  while (n > 0) {
+    if ((r = write(fd, p, n)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += r;
+    n -= r;
+  }
+  return 0;
+}
+
+/* writes and syncs the pending records as one group. buf is swapped out
+   first, so appends carry on into the other buffer meanwhile. A failure
+   is kept: the group may be half written, and every later one would
+   follow a group recovery will drop. */
+static int commit(wal_t *w) {
+  struct wal_group *g;
+  unsigned long len, nrec, cap;
+  char *p;
+  int err;
+
+  pthread_mutex_lock(&w->commit_lock);
+  pthread_mutex_lock(&w->lock);
+  p = w->buf;
+  len = w->len;
+  if ((nrec = w->pending)) {
+    w->buf = w->spare;
+    w->spare = p;
+    cap = w->cap;
+    w->cap = w->spare_cap;
+    w->spare_cap = cap;
+    w->len = HDR;
+    w->pending = 0;
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  if (nrec && !w->error) {
+    g = (struct wal_group *)p;
+    g->magic = WAL_MAGIC;
+    g->nrec = nrec;
+    g->len = len - HDR;
+    g->sum = hash_wy(p + HDR, len - HDR, WAL_SEED);
+    if (write_all(w->fd, p, len) < 0 || fdatasync(w->fd) < 0) {
+      w->error = errno;
+    } else {
+      w->groups++;
+      w->records += nrec;
+      w->bytes += len;
+    }
+  }
+  err = w->error;
+  pthread_mutex_unlock(&w->commit_lock);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static void *flusher(void *arg) {
+  wal_t *w = arg;
+  struct timespec ts;
+
+  pthread_mutex_lock(&w->lock);
+  while (!w->stopping) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (w->cfg.flush_ms % 1000) * 1000000;
+    ts.tv_sec += w->cfg.flush_ms / 1000 + ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+    if (w->stopping || !w->pending)
+      continue;
+    pthread_mutex_unlock(&w->lock);
+    commit(w);
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/* adds a record to the group, committing it if it is now full */
+static int append(wal_t *w, const char *key, const char *val) {
+  struct wal_rec r;
+  unsigned long klen = strlen(key), vlen = val ? strlen(val) : 0;
+  unsigned long need = sizeof(r) + klen + 1 + (val ? vlen + 1 : 0);
+  int full;
+
+  if (w->error) {
+    errno = w->error;
+    return -1;
+  }
+  r.klen = klen;
+  r.vlen = val ? vlen : WAL_DEL;
+  pthread_mutex_lock(&w->lock);
+  if (w->len + need > w->cap) {
+    while (w->len + need > w->cap)
+      w->cap *= 2;
+    w->buf = realloc(w->buf, w->cap);
+  }
+  memcpy(w->buf + w->len, &r, sizeof(r));
+  memcpy(w->buf + w->len + sizeof(r), key, klen + 1);
+  if (val)
+    memcpy(w->buf + w->len + sizeof(r) + klen + 1, val, vlen + 1);
+  w->len += need;
+  w->pending++;
+  full = (w->cfg.group_ops && w->pending >= w->cfg.group_ops)
+    || (w->cfg.group_bytes && w->len - HDR >= w->cfg.group_bytes)
+    || (!w->cfg.group_ops && !w->cfg.group_bytes && !w->cfg.flush_ms);
+  pthread_mutex_unlock(&w->lock);
+  return full ? commit(w) : 0;
+}
+
+int wal_put(wal_t *w, hashtable_t *ht, const char *key, const char *val) {
+  if (append(w, key, val) < 0)
+    return -1;
+  ht_put_str(ht, key, val);
+  return 0;
+}
+
+int wal_del(wal_t *w, hashtable_t *ht, const char *key) {
+  if (append(w, key, NULL) < 0)
+    return -1;
+  ht_del(ht, (char *)key);
+  return 0;
+}
+
+int wal_sync(wal_t *w) {
+  return commit(w);
+}
+
+int wal_close(wal_t *w) {
+  int ret;
+
+  if (w->cfg.flush_ms) {
+    pthread_mutex_lock(&w->lock);
+    w->stopping = 1;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->flusher, NULL);
+  }
+  ret = commit(w);
+  close(w->fd);
+  pthread_mutex_destroy(&w->lock);
+  pthread_mutex_destroy(&w->commit_lock);
+  pthread_cond_destroy(&w->wake);
+  free(w->buf);
+  free(w->spare);
+  free(w);
+  return ret;
+}
+
+/* length of the whole, intact groups at the start of the log, counting
+   their puts and deletes */
+static unsigned long valid_prefix(const char *p, unsigned long size,
+                                  unsigned long *puts, unsigned long *dels) {
+  struct wal_group g;
+  struct wal_rec r;
+  unsigned long off = 0, i, roff, end, np, nd;
+
+  while (size - off >= HDR) {
+    memcpy(&g, p + off, HDR);
+    if (g.magic != WAL_MAGIC || g.len > size - off - HDR
+        || g.sum != hash_wy(p + off + HDR, g.len, WAL_SEED))
+      break;
+    roff = off + HDR;
+    end = roff + g.len;
+    np = nd = 0;
+    for (i=0; i<g.nrec; i++) {
+      if (end - roff < sizeof(r))
+        break;
+      memcpy(&r, p + roff, sizeof(r));
+      roff += sizeof(r) + r.klen + 1;
+      if (r.vlen == WAL_DEL) {
+        nd++;
+      } else {
+        roff += r.vlen + 1;
+        np++;
+      }
+      if (roff > end)
+        break;
+    }
+    if (i < g.nrec || roff != end)
+      break;
+    *puts += np;
+    *dels += nd;
+    off = end;
+  }
+  return off;
+}
+
+hashtable_t *wal_recover(const char *path, const ht_config_t *cfg) {
+  unsigned long size, valid, off, end, hint, puts = 0, dels = 0;
+  struct wal_group g;
+  struct wal_rec r;
+  struct stat st;
+  hashtable_t *ht;
+  char *p, *key;
+  int fd;
+
+  if ((fd = open(path, O_RDWR)) < 0) {
+    if (errno == ENOENT)
+      return make_hashtable_cfg(1024, cfg);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if ((size = st.st_size) == 0) {
+    close(fd);
+    return make_hashtable_cfg(1024, cfg);
+  }
+  p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+
+  valid = valid_prefix(p, size, &puts, &dels);
+  if (valid < size && ftruncate(fd, valid) < 0) {
+    munmap(p, size);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  /* an estimate: overwrites make it high, deletes of absent keys low */
+  hint = puts > dels ? puts - dels : 0;
+  ht = make_hashtable_cfg(hint > 1024 ? hint : 1024, cfg);
+  for (off=0; off<valid; ) {
+    memcpy(&g, p + off, HDR);
+    end = off + HDR + g.len;
+    for (off += HDR; off < end; ) {
+      memcpy(&r, p + off, sizeof(r));
+      key = p + off + sizeof(r);
+      off += sizeof(r) + r.klen + 1;
+      if (r.vlen == WAL_DEL) {
+        ht_del(ht, key);
+      } else {
+        ht_put_str(ht, key, p + off);
+        off += r.vlen + 1;
+      }
+    }
+  }
+  munmap(p, size);
+  return ht;
+}
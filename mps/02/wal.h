@@ -0,0 +1,64 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include "hashtable.h"
+
+/* Write-ahead log of puts and deletes, for rebuilding a table after a
+   crash. wal_put and wal_del append a record to an in-memory group and
+   then apply the change to the table; a group is written and
+   fdatasync()ed as one unit once it holds group_ops records or
+   group_bytes bytes, every flush_ms milliseconds if that is set, or on
+   wal_sync. A change is durable once its group is. Values are taken to
+   be strings, as by ht_put_str. The log never holds pointers, so any
+   backend can be rebuilt from it with wal_recover. */
+
+typedef struct wal_config {
+  unsigned long group_ops;      /* records per group; 0 = no limit */
+  unsigned long group_bytes;    /* bytes per group; 0 = no limit */
+  unsigned long flush_ms;       /* commit pending records this often; 0 =
+                                   only when a group fills */
+} wal_config_t;
+
+typedef struct wal {
+  int fd;
+  wal_config_t cfg;
+  /* records are appended to buf, after room for the group header; a
+     commit swaps it with spare, so appends go on while spare is synced */
+  pthread_mutex_t lock;
+  char *buf, *spare;
+  unsigned long len, cap, spare_cap;
+  unsigned long pending;        /* records in buf */
+  pthread_mutex_t commit_lock;  /* one group written at a time, in order */
+  int error;                    /* errno of a failed commit, kept */
+  /* the flusher thread, if flush_ms is set */
+  pthread_t flusher;
+  pthread_cond_t wake;
+  int stopping;
+  unsigned long groups, records, bytes;   /* committed */
+} wal_t;
+
+/* opens path for appending, creating it if need be; a zeroed config (or
+   NULL) syncs every record. Returns NULL with errno set on failure. */
+wal_t *wal_open(const char *path, const wal_config_t *cfg);
+
+/* 0, or -1 with errno set if the log could not be written, in which
+   case the table is left unchanged */
+int   wal_put(wal_t *w, hashtable_t *ht, const char *key, const char *val);
+int   wal_del(wal_t *w, hashtable_t *ht, const char *key);
+
+/* commits any pending records, returning once they are durable */
+int   wal_sync(wal_t *w);
+
+/* syncs, then closes; returns -1 if that sync failed */
+int   wal_close(wal_t *w);
+
+/* A table holding what the log at path describes, made by
+   make_hashtable_cfg with room up front for as many entries as the log
+   has puts, less deletes. A group that was not completely written, and
+   any after it, is dropped, and the file truncated to the groups before
+   it. A missing file gives an empty table. Returns NULL with errno set
+   on failure. */
+hashtable_t *wal_recover(const char *path, const ht_config_t *cfg);
+
+#endif